@@ -10,3 +10,6 @@ CFLAGS = -std=c99 -pedantic -Wall -Wextra -I/usr/local/include
 
 # grapheme.h
 LIBS = -L/usr/local/lib -lgrapheme
+
+# dlopen(3), leave it empty on the BSDs
+DLLIB = -ldl
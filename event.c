@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2023 Jan Klemkow <j.klemkow@wemelug.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#ifdef __linux__
+#define USE_EPOLL
+#include <sys/epoll.h>
+#elif defined(__OpenBSD__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+    defined(__DragonFly__) || defined(__APPLE__)
+#define USE_KQUEUE
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "event.h"
+
+/* maximum amount of events per wait */
+#define EVENT_BATCH	32
+
+struct handler {
+	event_cb *cb;		/* NULL for unregistered descriptors */
+	void *arg;
+	int events;		/* events we are interested in */
+};
+
+/* registered callbacks, indexed by their descriptor */
+static struct handler *handler;
+static size_t nhandler;
+
+#ifdef USE_EPOLL
+static int epfd = -1;
+#elif defined(USE_KQUEUE)
+static int kq = -1;
+#else
+/* the descriptors for poll(2), rebuilt after every change */
+static struct pollfd *pfd;
+static size_t npfd;
+static bool dirty;
+#endif
+
+/*
+ * With epoll(7) and kqueue(2), a wakeup only reports the ready descriptors.
+ * The poll(2) fallback looks at all of them.
+ */
+void
+event_init(void)
+{
+#ifdef USE_EPOLL
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		die("epoll_create1:");
+#elif defined(USE_KQUEUE)
+	if ((kq = kqueue()) == -1)
+		die("kqueue:");
+#endif
+}
+
+#ifdef USE_EPOLL
+static int
+event_epoll(int op, int fd, int events)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof ev);
+	ev.data.fd = fd;
+	if (events & EVENT_IN)
+		ev.events |= EPOLLIN;
+	if (events & EVENT_OUT)
+		ev.events |= EPOLLOUT;
+
+	if (epoll_ctl(epfd, op, fd, &ev) == -1) {
+		if (errno == EPERM)	/* regular files are always ready */
+			return -1;
+		die("epoll_ctl:");
+	}
+
+	return 0;
+}
+#elif defined(USE_KQUEUE)
+/* set both filters of fd to the state of events */
+static void
+event_kevent(int fd, int flags, int events)
+{
+	struct kevent kev[2];
+
+	EV_SET(&kev[0], fd, EVFILT_READ, flags |
+	    (events & EVENT_IN ? EV_ENABLE : EV_DISABLE), 0, 0, NULL);
+	EV_SET(&kev[1], fd, EVFILT_WRITE, flags |
+	    (events & EVENT_OUT ? EV_ENABLE : EV_DISABLE), 0, 0, NULL);
+
+	if (kevent(kq, kev, 2, NULL, 0, NULL) == -1)
+		die("kevent:");
+}
+#endif
+
+/*
+ * Call cb with the events of fd, until it is removed by event_del().
+ * Returns -1, if fd cannot be watched, like a regular file under epoll(7).
+ */
+int
+event_add(int fd, int events, event_cb *cb, void *arg)
+{
+	if ((size_t)fd >= nhandler) {
+		size_t n = fd + 16;
+		struct handler *h;
+
+		if ((h = realloc(handler, n * sizeof *h)) == NULL)
+			die("realloc:");
+		memset(h + nhandler, 0, (n - nhandler) * sizeof *h);
+		handler = h;
+		nhandler = n;
+	}
+
+	handler[fd].cb = cb;
+	handler[fd].arg = arg;
+	handler[fd].events = events;
+#ifdef USE_EPOLL
+	if (event_epoll(EPOLL_CTL_ADD, fd, events) == -1) {
+		handler[fd].cb = NULL;
+		return -1;
+	}
+#elif defined(USE_KQUEUE)
+	event_kevent(fd, EV_ADD, events);
+#else
+	dirty = true;
+#endif
+	return 0;
+}
+
+/* change the events of interest, without a system call if they are equal */
+void
+event_mod(int fd, int events)
+{
+	if (handler[fd].events == events)
+		return;
+
+	handler[fd].events = events;
+#ifdef USE_EPOLL
+	event_epoll(EPOLL_CTL_MOD, fd, events);
+#elif defined(USE_KQUEUE)
+	event_kevent(fd, 0, events);
+#else
+	dirty = true;
+#endif
+}
+
+/* forget fd, before it gets closed */
+void
+event_del(int fd)
+{
+	handler[fd].cb = NULL;
+#ifdef USE_EPOLL
+	if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL) == -1)
+		die("epoll_ctl:");
+#elif defined(USE_KQUEUE)
+	struct kevent kev[2];
+
+	EV_SET(&kev[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+	EV_SET(&kev[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+	if (kevent(kq, kev, 2, NULL, 0, NULL) == -1)
+		die("kevent:");
+#else
+	dirty = true;
+#endif
+}
+
+static void
+event_call(int fd, int events)
+{
+	/* an earlier callback of this wakeup may have removed fd */
+	if ((size_t)fd < nhandler && handler[fd].cb != NULL)
+		handler[fd].cb(fd, events, handler[fd].arg);
+}
+
+#if !defined(USE_EPOLL) && !defined(USE_KQUEUE)
+static void
+event_rebuild(void)
+{
+	struct pollfd *p;
+	size_t n = 0;
+
+	for (size_t fd = 0; fd < nhandler; fd++)
+		if (handler[fd].cb != NULL)
+			n++;
+	if ((p = realloc(pfd, (n + 1) * sizeof *p)) == NULL)
+		die("realloc:");
+	pfd = p;
+	npfd = 0;
+
+	for (size_t fd = 0; fd < nhandler; fd++) {
+		if (handler[fd].cb == NULL)
+			continue;
+		pfd[npfd].fd = fd;
+		pfd[npfd].events = 0;
+		if (handler[fd].events & EVENT_IN)
+			pfd[npfd].events |= POLLIN;
+		if (handler[fd].events & EVENT_OUT)
+			pfd[npfd].events |= POLLOUT;
+		npfd++;
+	}
+	dirty = false;
+}
+#endif
+
+/*
+ * Wait at most timeout milliseconds, -1 for ever, and call the callbacks
+ * of the ready descriptors.  A signal just ends the wait.
+ */
+void
+event_wait(int timeout)
+{
+#ifdef USE_EPOLL
+	struct epoll_event ev[EVENT_BATCH];
+	int n;
+
+	if ((n = epoll_wait(epfd, ev, EVENT_BATCH, timeout)) == -1) {
+		if (errno == EINTR)
+			return;
+		die("epoll_wait:");
+	}
+
+	for (int i = 0; i < n; i++) {
+		int events = 0;
+
+		if (ev[i].events & EPOLLIN)
+			events |= EVENT_IN;
+		if (ev[i].events & EPOLLOUT)
+			events |= EVENT_OUT;
+		if (ev[i].events & EPOLLHUP)
+			events |= EVENT_HUP;
+		if (ev[i].events & EPOLLERR)
+			events |= EVENT_ERR;
+		event_call(ev[i].data.fd, events);
+	}
+#elif defined(USE_KQUEUE)
+	struct kevent ev[EVENT_BATCH];
+	struct timespec ts, *tp = NULL;
+	int n;
+
+	if (timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+		tp = &ts;
+	}
+
+	if ((n = kevent(kq, NULL, 0, ev, EVENT_BATCH, tp)) == -1) {
+		if (errno == EINTR)
+			return;
+		die("kevent:");
+	}
+
+	for (int i = 0; i < n; i++) {
+		int events = ev[i].filter == EVFILT_READ ? EVENT_IN :
+		    EVENT_OUT;
+
+		if (ev[i].flags & EV_EOF)
+			events |= EVENT_HUP;
+		if (ev[i].flags & EV_ERROR)
+			events = EVENT_ERR;
+		event_call(ev[i].ident, events);
+	}
+#else
+	int n;
+
+	if (dirty)
+		event_rebuild();
+
+	if ((n = poll(pfd, npfd, timeout)) == -1) {
+		if (errno == EINTR)
+			return;
+		die("poll:");
+	}
+
+	for (size_t i = 0; i < npfd && n > 0; i++) {
+		int events = 0;
+
+		if (pfd[i].revents == 0)
+			continue;
+		n--;
+		if (pfd[i].revents & POLLIN)
+			events |= EVENT_IN;
+		if (pfd[i].revents & POLLOUT)
+			events |= EVENT_OUT;
+		if (pfd[i].revents & POLLHUP)
+			events |= EVENT_HUP;
+		if (pfd[i].revents & (POLLERR|POLLNVAL))
+			events |= EVENT_ERR;
+		event_call(pfd[i].fd, events);
+	}
+#endif
+}
@@ -0,0 +1,18 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+/* events of a descriptor, HUP and ERR are reported without being asked */
+#define EVENT_IN	0x1
+#define EVENT_OUT	0x2
+#define EVENT_HUP	0x4
+#define EVENT_ERR	0x8
+
+typedef void event_cb(int fd, int events, void *arg);
+
+void event_init(void);
+int event_add(int fd, int events, event_cb *cb, void *arg);
+void event_mod(int fd, int events);
+void event_del(int fd);
+void event_wait(int timeout);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+/*
+ * Interface of a .filter.so plugin, which lchat loads instead of forking
+ * the .filter program.  Only filter_line() is mandatory.
+ *
+ * filter_init() is called once after loading and returns -1 on error.
+ * filter_line() gets every complete backend line without its newline and
+ * writes the filtered line, including a newline, to out.  It may change the
+ * content of line.  filter_flush() is called after every chunk of backend
+ * input.
+ */
+int filter_init(void);
+void filter_line(FILE *out, char *line);
+void filter_flush(FILE *out);
+
+#endif
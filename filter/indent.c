@@ -1,4 +1,13 @@
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <regex.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,81 +15,189 @@
 #include <unistd.h>
 
 #include "../util.h"
+#include "../width.h"
+#include "filter.h"
 
 #define color1 34
 #define color2 33
 #define color3 35
 
-int
-main(void)
+static char old_nick[BUFSIZ] = "";
+static int color = color1;
+static struct bell *bell;
+static int cols = 80;		/* terminal width */
+
+/* HH:MM of the last formatted minute */
+static char timestr[BUFSIZ];
+static time_t minute = -1;
+
+/* lchat shares its terminal with us, stdout is a pipe */
+static void
+update_cols(void)
+{
+	struct winsize ws;
+	int fd;
+
+	if (ioctl(STDERR_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) {
+		cols = ws.ws_col;
+		return;
+	}
+
+	if ((fd = open("/dev/tty", O_RDONLY|O_NOCTTY|O_CLOEXEC)) == -1)
+		return;
+	if (ioctl(fd, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+		cols = ws.ws_col;
+	close(fd);
+}
+
+/* print one line, which has no newline */
+static void
+indent(FILE *out, char *buf)
 {
-	char buf[BUFSIZ];
-	char timestr[BUFSIZ];
-	char old_nick[BUFSIZ] = "";
 	char *fmt = "%H:%M";
 	char *next, *nick, *word;
-	int cols = 80;		/* terminal width */
-	int color = color1;
-	char *bell_file = ".bellmatch";
+	const char *shown;	/* nick or nothing, if it repeats */
+	size_t nw;		/* width of shown */
+	time_t time = strtol(buf, &next, 10);
 
-	while (fgets(buf, sizeof buf, stdin) != NULL) {
-		time_t time = strtol(buf, &next, 10);
-		struct tm *tm = localtime(&time);
+	if (*next != '\0')
+		next++;			/* skip space */
 
-		next++;				/* skip space */
+	if (next[0] == '-' || time == 0) {
+		fprintf(out, "%s\n", buf);
+		return;
+	}
 
-		if (next == NULL || next[0] == '-' || time == 0) {
-			fputs(buf, stdout);
-			fflush(stdout);
-			continue;
+	nick = strsep(&next, ">");
+	if (next == NULL) {
+		fprintf(out, "%s\n", buf);
+		return;
+	}
+	nick++;				/* skip '<'   */
+	next++;				/* skip space */
+
+	/* lines of the same minute share their time string */
+	if (time / 60 != minute) {
+		minute = time / 60;
+		strftime(timestr, sizeof timestr, fmt, localtime(&time));
+	}
+
+	/* swap color */
+	if (strcmp(nick, old_nick) != 0)
+		color = color == color1 ? color2 : color1;
+
+	if (bell->exists && bell_match(bell, next))
+		color = color3;
+
+	/* print prompt */
+	/* HH:MM nnnnnnnnnnnn ttttttttttttt */
+	// e[7;30;40m
+	shown = strcmp(nick, old_nick) == 0 ? "" : nick;
+	nw = width_str(shown, strlen(shown));
+	fprintf(out, "\033[1;%dm\033[K%s %*s%s", color, timestr,
+	    nw < 12 ? (int)(12 - nw) : 0, "", shown);
+
+	strlcpy(old_nick, nick, sizeof old_nick);
+
+	ssize_t pw = 18;	/* prompt width */
+	ssize_t tw = cols - pw;	/* text width */
+	bool first = true;
+
+	/* print indented text */
+	while ((word = strsep(&next, " ")) != NULL) {
+		tw -= width_str(word, strlen(word)) + 1;
+		if (tw < 0 && !first) {
+			fputs("\n                  ", out);
+			tw = cols - pw;
+			first = true;
 		}
 
-		nick = strsep(&next, ">");
-		if (next == NULL) {
-			fputs(buf, stdout);
-			fflush(stdout);
+		fputc(' ', out);
+		fputs(word, out);
+		first = false;
+	}
+	fputs("\n\033[0m\033[K", out);	/* turn color off */
+}
+
+#ifdef PLUGIN
+/* entry points of the .filter.so plugin, see filter.h */
+int
+filter_init(void)
+{
+	bell = bell_init(".bellmatch", true);
+	update_cols();
+	return 0;
+}
+
+void
+filter_line(FILE *out, char *line)
+{
+	indent(out, line);
+}
+
+/*
+ * lchat flushes its output itself, just look for a new .bellmatch.  The
+ * SIGWINCH handler belongs to lchat, so ask for the width every time.
+ */
+void
+filter_flush(FILE *out)
+{
+	(void)out;
+	bell_update(bell);
+	update_cols();
+}
+#else
+static volatile sig_atomic_t winch;
+
+static void
+sigwinch(int sig)
+{
+	(void)sig;
+	winch = 1;
+}
+
+int
+main(void)
+{
+	struct sigaction sa;
+	struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+	struct linebuf lb = {NULL, 0, 0};
+	char buf[BUFSIZ];
+	ssize_t n;
+
+	bell = bell_init(".bellmatch", true);
+	update_cols();
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = sigwinch;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGWINCH, &sa, NULL) == -1)
+		die("sigaction:");
+
+	while ((n = read(STDIN_FILENO, buf, sizeof buf)) != 0) {
+		const char *data = buf;
+		size_t len = n;
+		char *line;
+
+		if (n == -1 && errno == EINTR)
 			continue;
+		if (n == -1)
+			die("read:");
+
+		if (winch) {
+			winch = 0;
+			update_cols();
 		}
-		nick++;				/* skip '<'   */
-		next++;				/* skip space */
-
-		strftime(timestr, sizeof timestr, fmt, tm);
-
-		/* swap color */
-		if (strcmp(nick, old_nick) != 0)
-			color = color == color1 ? color2 : color1;
-
-		if (access(bell_file, R_OK) == 0 && bell_match(next, bell_file))
-			color = color3;
-
-		/* print prompt */
-		/* HH:MM nnnnnnnnnnnn ttttttttttttt */
-		// e[7;30;40m
-		printf("\033[1;%dm\033[K%s %*s", color, timestr, 12,
-		    strcmp(nick, old_nick) == 0 ? "" : nick);
-
-		strlcpy(old_nick, nick, sizeof old_nick);
-
-		ssize_t pw = 18;	/* prompt width */
-		ssize_t tw = cols - pw;	/* text width */
-		bool first = true;
-
-		/* print indented text */
-		while ((word = strsep(&next, " ")) != NULL) {
-			tw -= strlen(word) + 1;
-			if (tw < 0 && !first) {
-				fputs("\n                  ", stdout);
-				tw = cols - pw;
-				first = true;
-			}
-
-			fputc(' ', stdout);
-			fputs(word, stdout);
-			first = false;
-		}
-		fputs("\033[0m\033[K", stdout);	/* turn color off */
-		fflush(stdout);
+
+		bell_update(bell);
+		while ((line = linebuf_next(&lb, &data, &len)) != NULL)
+			indent(stdout, line);
+
+		/* flush, when there is no more input waiting */
+		if (poll(&pfd, 1, 0) == 0 && fflush(stdout) == EOF)
+			die("fflush:");
 	}
 
 	return EXIT_SUCCESS;
 }
+#endif
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2023 Jan Klemkow <j.klemkow@wemelug.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "follow.h"
+
+/* initial size of the mapping for the history scan */
+#define HISTORY_WINDOW (1024 * 1024)
+
+/*
+ * Map the end of the file read-only and scan it backwards for the last
+ * lines.  The mapping grows until it contains enough lines or the whole
+ * file, so the costs depend on the amount of lines and not on the size of
+ * the file.
+ */
+static void
+follow_tail(struct follow *f, off_t size, size_t lines)
+{
+	off_t page = sysconf(_SC_PAGESIZE);
+	off_t want = HISTORY_WINDOW;
+	off_t pos = size;	/* [pos, size) is already scanned */
+
+	f->map = NULL;
+	f->maplen = 0;
+	f->mapoff = 0;
+	f->hist = f->histend = size;
+
+	if (lines == 0 || size == 0)
+		return;
+
+	for (;;) {
+		off_t moff = size > want ? (size - want) / page * page : 0;
+		const char *nl;
+
+		if (f->map != NULL && munmap(f->map, f->maplen) == -1)
+			die("munmap:");
+		f->mapoff = moff;
+		f->maplen = size - moff;
+		if ((f->map = mmap(NULL, f->maplen, PROT_READ, MAP_SHARED,
+		    f->fd, moff)) == MAP_FAILED)
+			die("mmap:");
+
+		/* the newline at the end of file terminates the last line */
+		if (pos == size && f->map[f->maplen - 1] == '\n')
+			pos--;
+
+		while ((nl = memrchr(f->map, '\n', pos - moff)) != NULL) {
+			pos = moff + (nl - f->map);
+			if (--lines == 0) {
+				f->hist = pos + 1;
+				return;
+			}
+		}
+		if (moff == 0)
+			break;
+		pos = moff;
+		want *= 2;
+	}
+	f->hist = 0;
+}
+
+static void
+follow_fd(struct follow *f, int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) == -1)
+		die("fstat:");
+
+	f->fd = fd;
+	f->dev = st.st_dev;
+	f->ino = st.st_ino;
+	f->off = 0;
+}
+
+/*
+ * Open path and position the read offset in front of its last lines.
+ * Changes of path are reported through f->watch.
+ */
+void
+follow_open(struct follow *f, const char *path, size_t lines)
+{
+	struct stat st;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY|O_CLOEXEC)) == -1)
+		die("open: %s:", path);
+	if (fstat(fd, &st) == -1)
+		die("fstat:");
+
+	follow_fd(f, fd);
+	follow_tail(f, st.st_size, lines);
+
+	/* read new data after the mapped history */
+	f->off = st.st_size;
+	if (lseek(fd, f->off, SEEK_SET) == -1)
+		die("lseek:");
+
+	watch_init(&f->watch, path, true);
+}
+
+/*
+ * Returns the next chunk of at most size bytes of the history straight out
+ * of the mapping, or 0 when the history is done.
+ */
+size_t
+follow_history(struct follow *f, const char **data, size_t size)
+{
+	size_t n = f->histend - f->hist;
+
+	/* never touch pages behind the end of a truncated file */
+	if (f->watch.exists && f->watch.dev == f->dev &&
+	    f->watch.ino == f->ino && f->watch.size < f->histend)
+		n = 0;
+
+	if (n == 0) {
+		if (f->map != NULL && munmap(f->map, f->maplen) == -1)
+			die("munmap:");
+		f->map = NULL;
+		f->hist = f->histend;
+		return 0;
+	}
+
+	if (n > size)
+		n = size;
+	*data = f->map + (f->hist - f->mapoff);
+	f->hist += n;
+
+	return n;
+}
+
+/* returns true, if the end of f->fd was not the end of the file */
+static bool
+follow_eof(struct follow *f)
+{
+	struct stat st;
+	int fd;
+
+	/* truncation */
+	if (fstat(f->fd, &st) == -1)
+		die("fstat:");
+	if (st.st_size < f->off) {
+		if (lseek(f->fd, 0, SEEK_SET) == -1)
+			die("lseek:");
+		f->off = 0;
+		return true;
+	}
+
+	/* rotation */
+	if (!f->watch.exists ||
+	    (f->watch.dev == f->dev && f->watch.ino == f->ino))
+		return false;
+	if ((fd = open(f->watch.path, O_RDONLY|O_CLOEXEC)) == -1) {
+		if (errno == ENOENT)
+			return false;
+		die("open: %s:", f->watch.path);
+	}
+	if (close(f->fd) == -1)
+		die("close:");
+	follow_fd(f, fd);
+
+	return true;
+}
+
+/*
+ * Read new data of the followed file.  Returns 0 if there is nothing left
+ * to read.  A truncated file is read again from its start.  If path was
+ * replaced by a new file, the old one is read to its end before switching
+ * over to the new one.  Call watch_check() on f->watch beforehand, to keep
+ * track of replacements.
+ */
+ssize_t
+follow_read(struct follow *f, char *buf, size_t size)
+{
+	ssize_t n;
+
+	for (;;) {
+		if ((n = read(f->fd, buf, size)) == -1) {
+			if (errno == EINTR)
+				continue;
+			die("read:");
+		}
+		if (n > 0) {
+			f->off += n;
+			return n;
+		}
+		if (!follow_eof(f))
+			return 0;
+	}
+}
+
+#ifdef __linux__
+/*
+ * Like follow_read(), but splice(2) moves the data into the pipe out
+ * without a copy through user space.  Returns -1 with errno EAGAIN, if the
+ * pipe is full, or EINVAL, if the file can not be spliced.
+ */
+ssize_t
+follow_splice(struct follow *f, int out, size_t size)
+{
+	ssize_t n;
+
+	for (;;) {
+		if ((n = splice(f->fd, NULL, out, NULL, size,
+		    SPLICE_F_MOVE|SPLICE_F_NONBLOCK)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EINVAL)
+				return -1;
+			die("splice:");
+		}
+		if (n > 0) {
+			f->off += n;
+			return n;
+		}
+		if (!follow_eof(f))
+			return 0;
+	}
+}
+#endif
+
+void
+follow_close(struct follow *f)
+{
+	if (f->map != NULL && munmap(f->map, f->maplen) == -1)
+		die("munmap:");
+	if (close(f->fd) == -1)
+		die("close:");
+	watch_free(&f->watch);
+}
@@ -0,0 +1,28 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+/* built-in replacement of tail -n lines -f path */
+struct follow {
+	struct watch watch;	/* changes of path */
+	int fd;			/* currently followed file */
+	dev_t dev;		/* identity of fd */
+	ino_t ino;
+	off_t off;		/* read position of fd */
+
+	/* read-only mapping of the history at startup */
+	char *map;
+	size_t maplen;
+	off_t mapoff;		/* file offset of map */
+	off_t hist;		/* file offset of the unread history */
+	off_t histend;
+};
+
+void follow_open(struct follow *f, const char *path, size_t lines);
+size_t follow_history(struct follow *f, const char **data, size_t size);
+ssize_t follow_read(struct follow *f, char *buf, size_t size);
+#ifdef __linux__
+ssize_t follow_splice(struct follow *f, int out, size_t size);
+#endif
+void follow_close(struct follow *f);
+
+#endif
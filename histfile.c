@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2023 Jan Klemkow <j.klemkow@wemelug.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "histfile.h"
+
+/* compact the file after this amount of appended lines */
+#define HISTFILE_COMPACT	1024
+
+/* the compacted file keeps this amount of the newest lines */
+#define HISTFILE_LINES		100000
+
+/* at exit, compact the file, if it grew by this amount of bytes */
+#define HISTFILE_GROWTH		(64 * 1024)
+
+struct span {
+	size_t off;
+	size_t len;
+};
+
+static int
+histfile_fd(struct histfile *hf)
+{
+	struct stat st;
+
+	if ((hf->fd = open(hf->path, O_RDWR|O_APPEND|O_CREAT|O_CLOEXEC,
+	    0600)) == -1)
+		return -1;
+	if (fstat(hf->fd, &st) == -1) {
+		int err = errno;
+
+		close(hf->fd);
+		hf->fd = -1;
+		errno = err;
+		return -1;
+	}
+
+	hf->dev = st.st_dev;
+	hf->ino = st.st_ino;
+	hf->size = st.st_size;
+
+	return 0;
+}
+
+/* report an error and go on without the file */
+static void
+histfile_disable(struct histfile *hf, const char *what)
+{
+	fprintf(stderr, "%s: %s: %s, history is not saved\n", what,
+	    hf->path, strerror(errno));
+	if (hf->fd != -1)
+		close(hf->fd);
+	hf->fd = -1;
+}
+
+/*
+ * Open or create the history file at path.  Its content is just mapped and
+ * not parsed, the slackline reads the lines it needs out of hf->map.  If
+ * the file is not usable, e.g. in a read-only directory, hf->fd is -1 and
+ * the other functions do nothing.
+ */
+void
+histfile_open(struct histfile *hf, const char *path)
+{
+	if ((hf->path = strdup(path)) == NULL)
+		die("strdup:");
+	hf->appends = 0;
+	hf->map = NULL;
+	hf->maplen = 0;
+
+	if (histfile_fd(hf) == -1) {
+		histfile_disable(hf, "open");
+		return;
+	}
+	if (hf->size == 0)
+		return;
+
+	if ((hf->map = mmap(NULL, hf->size, PROT_READ, MAP_SHARED, hf->fd,
+	    0)) == MAP_FAILED) {
+		hf->map = NULL;
+		histfile_disable(hf, "mmap");
+		return;
+	}
+	hf->maplen = hf->size;
+}
+
+/* append len bytes of line, including its newline */
+void
+histfile_append(struct histfile *hf, const char *line, size_t len)
+{
+	struct stat st;
+
+	if (hf->fd == -1)
+		return;
+
+	/* another lchat has compacted the file in the meantime */
+	if (stat(hf->path, &st) == -1 || st.st_dev != hf->dev ||
+	    st.st_ino != hf->ino) {
+		close(hf->fd);
+		if (histfile_fd(hf) == -1) {
+			histfile_disable(hf, "open");
+			return;
+		}
+	}
+
+	if (write(hf->fd, line, len) == -1) {
+		histfile_disable(hf, "write");
+		return;
+	}
+
+	/* a failed compaction is retried after the next lines */
+	if (++hf->appends >= HISTFILE_COMPACT && histfile_compact(hf) == -1) {
+		if (hf->fd == -1)
+			histfile_disable(hf, "histfile_compact");
+		else
+			fprintf(stderr, "histfile_compact: %s: %s\n",
+			    hf->path, strerror(errno));
+	}
+}
+
+static uint_least32_t
+hash(const char *str, size_t len)
+{
+	uint_least32_t h = 2166136261u;
+
+	for (size_t i = 0; i < len; i++)
+		h = ((h ^ (unsigned char)str[i]) * 16777619u) & 0xffffffff;
+
+	return h;
+}
+
+/*
+ * Rewrite the file with only the newest copy of every line and at most
+ * HISTFILE_LINES lines.  The new file replaces the old one by rename(2).
+ * Returns -1 with errno set on error.
+ */
+int
+histfile_compact(struct histfile *hf)
+{
+	struct stat st;
+	struct span *keep = NULL;
+	size_t *set = NULL, nkeep = 0, max, mask = 1, end;
+	char *map = MAP_FAILED, *tmp = NULL;
+	FILE *fp = NULL;
+	int fd = -1, ret = -1, err;
+
+	hf->appends = 0;
+
+	if (fstat(hf->fd, &st) == -1)
+		return -1;
+	if (st.st_size == 0)
+		return 0;
+	if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, hf->fd, 0))
+	    == MAP_FAILED)
+		return -1;
+
+	/* every line needs at least two bytes */
+	max = st.st_size / 2 + 1;
+	if (max > HISTFILE_LINES)
+		max = HISTFILE_LINES;
+	while (mask < max * 2)
+		mask <<= 1;
+	if ((keep = malloc(max * sizeof *keep)) == NULL)
+		goto out;
+	if ((set = malloc(mask * sizeof *set)) == NULL)
+		goto out;
+	memset(set, 0xff, mask * sizeof *set);
+	mask--;
+
+	/* walk from the newest to the oldest line, keep new lines */
+	end = st.st_size;
+	if (map[end - 1] == '\n')
+		end--;
+	while (nkeep < max) {
+		size_t start = end, len, i;
+
+		while (start > 0 && map[start - 1] != '\n')
+			start--;
+		len = end - start;
+
+		i = hash(map + start, len) & mask;
+		while (len > 0 && set[i] != SIZE_MAX &&
+		    (keep[set[i]].len != len ||
+		    memcmp(map + keep[set[i]].off, map + start, len) != 0))
+			i = (i + 1) & mask;
+		if (len > 0 && set[i] == SIZE_MAX) {
+			set[i] = nkeep;
+			keep[nkeep].off = start;
+			keep[nkeep++].len = len;
+		}
+
+		if (start == 0)
+			break;
+		end = start - 1;
+	}
+
+	/* a unique name, other lchats may compact the same file */
+	if (asprintf(&tmp, "%s.XXXXXX", hf->path) == -1) {
+		tmp = NULL;
+		goto out;
+	}
+	if ((fd = mkstemp(tmp)) == -1)
+		goto out;
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1 ||
+	    (fp = fdopen(fd, "w")) == NULL)
+		goto unlink;
+	fd = -1;
+
+	while (nkeep-- > 0) {
+		fwrite(map + keep[nkeep].off, 1, keep[nkeep].len, fp);
+		putc('\n', fp);
+	}
+	err = ferror(fp);
+	if (fclose(fp) == EOF || err) {
+		fp = NULL;
+		goto unlink;
+	}
+	fp = NULL;
+	if (rename(tmp, hf->path) == -1)
+		goto unlink;
+
+	/* append to the new file from now on */
+	close(hf->fd);
+	if (histfile_fd(hf) == -1)
+		goto out;
+	ret = 0;
+	goto out;
+
+ unlink:
+	err = errno;
+	unlink(tmp);
+	errno = err;
+ out:
+	err = errno;
+	if (fp != NULL)
+		fclose(fp);
+	if (fd != -1)
+		close(fd);
+	if (map != MAP_FAILED)
+		munmap(map, st.st_size);
+	free(tmp);
+	free(set);
+	free(keep);
+	errno = err;
+
+	return ret;
+}
+
+/*
+ * Compact the file, if it grew enough, and release hf.  This runs at exit,
+ * so errors are reported on stderr and returned as -1.
+ */
+int
+histfile_close(struct histfile *hf)
+{
+	struct stat st;
+	int ret = 0;
+
+	if (hf->fd != -1 && hf->appends > 0 && fstat(hf->fd, &st) == 0 &&
+	    st.st_size >= hf->size + HISTFILE_GROWTH &&
+	    histfile_compact(hf) == -1) {
+		fprintf(stderr, "histfile_compact: %s: %s\n", hf->path,
+		    strerror(errno));
+		ret = -1;
+	}
+
+	if (hf->map != NULL)
+		munmap(hf->map, hf->maplen);
+	if (hf->fd != -1 && close(hf->fd) == -1) {
+		fprintf(stderr, "close: %s: %s\n", hf->path, strerror(errno));
+		ret = -1;
+	}
+	free(hf->path);
+	hf->path = NULL;
+
+	return ret;
+}
@@ -0,0 +1,23 @@
+#ifndef HISTFILE_H
+#define HISTFILE_H
+
+/* append-only file of the submitted lines */
+struct histfile {
+	char *path;
+	int fd;			/* opened with O_APPEND */
+	dev_t dev;		/* identity of fd */
+	ino_t ino;
+	size_t appends;		/* lines appended since the last compaction */
+	off_t size;		/* size after opening or compaction */
+
+	/* read-only mapping of the file at startup */
+	char *map;
+	size_t maplen;
+};
+
+void histfile_open(struct histfile *hf, const char *path);
+void histfile_append(struct histfile *hf, const char *line, size_t len);
+int histfile_compact(struct histfile *hf);
+int histfile_close(struct histfile *hf);
+
+#endif
@@ -16,31 +16,152 @@
  */
 
 #include <sys/ioctl.h>
+#include <sys/types.h>
 
+#include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
 #include <limits.h>
-#include <poll.h>
+#include <regex.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <grapheme.h>
+
 #include "slackline.h"
 #include "util.h"
+#include "follow.h"
+#include "event.h"
+#include "histfile.h"
+#include "scrollback.h"
+#include "width.h"
+#include "filter/filter.h"
 
 #ifndef INFTIM
 #define INFTIM -1
 #endif
 
+/* stdout buffer, big enough for a redraw and some chunks of input */
+#define OUTBUF_SIZE (BUFSIZ * 8)
+
+/* default bound of the outgoing queue */
+#define OUTQ_SIZE (64 * 1024)
+
+/* stop reading the backend, when this amount waits for the .filter */
+#define FILTERQ_SIZE (64 * 1024)
+
+/* read at most this amount of backend data between two redraws */
+#define DRAIN_SIZE (64 * 1024)
+
 static struct termios origin_term;
 static struct winsize winsize;
 static char *TERM;
 
+/* submitted lines on their way to the backend */
+struct outq {
+	struct queue q;
+	size_t lines;	/* amount of lines in q */
+	int fd;		/* in file or ucspi descriptor */
+	char *file;	/* path of the in file, NULL for ucspi */
+	bool event;	/* fd is registered for EVENT_OUT */
+};
+
+/* bound of every outgoing queue in bytes */
+static size_t outq_max = OUTQ_SIZE;
+
+/* a chat directory with its own input line */
+struct channel {
+	char *dir;
+	struct slackline *sl;
+	struct follow follow;
+	bool pending;		/* unread data in out file */
+	bool unseen;		/* out file changed while inactive */
+	struct linebuf lb;	/* incomplete line for the bell */
+	struct outq outq;
+	struct histfile histfile;
+	struct scrollback sb;	/* lines of this channel */
+
+	/* every channel has its own .filter, so its output stays apart */
+	int sink;		/* terminal or .filter */
+	bool sink_full;		/* the .filter pipe took no more data */
+	struct queue filterq;	/* backend data on its way to the .filter */
+};
+
+static struct channel *chan;
+static size_t nchan;
+static struct channel *cur;	/* the channel on the terminal */
+
+/* shared by all channels */
+static struct bell *bell;
+static bool empty_line;
+static char *title;
+
+/*
+ * Without bell and plugin, the backend data passes unchanged to the .filter
+ * pipe.  On Linux, splice(2) moves it there without a copy through user
+ * space, as long as no older data waits in filterq.
+ */
+static bool zerocopy;
+
+/* in-process .filter.so, see filter/filter.h */
+static struct {
+	void *handle;
+	int (*init)(void);
+	void (*line)(FILE *out, char *line);
+	void (*flush)(FILE *out);
+	FILE *out;		/* memory stream of the output */
+	char *buf;
+	size_t len;
+} plugin;
+
+/* repaint the erased input line at most fps times a second, 0 for always */
+static unsigned int fps;
+static struct timespec frame;	/* time of the last repaint */
+
+/*
+ * Counters of the main loop, written to .stats on SIGUSR1.  The first
+ * signal also starts the timings, which cost a clock_gettime(3) each.
+ */
+static struct {
+	unsigned long long wakeups;	/* returns of event_wait() */
+	unsigned long long tty_in;	/* bytes of every source */
+	unsigned long long backend_in;
+	unsigned long long filter_in;
+	unsigned long long term_out;	/* bytes to every sink */
+	unsigned long long filter_out;
+	unsigned long long backend_out;
+	unsigned long long redraws;	/* repaints of the whole input line */
+	unsigned long long updates;	/* repaints of its changed part */
+	unsigned long long bell_lines;	/* lines given to the bell matcher */
+	unsigned long long stalls;	/* a full .filter held back input */
+	bool timed;
+	uint_least64_t bell_ns;		/* time spent in the bell matcher */
+	uint_least64_t loop_ns;		/* longest loop iteration */
+} stats;
+static volatile sig_atomic_t stats_request;
+
+/* the input line as currently shown on the terminal */
+static struct {
+	bool shown;		/* false after erase or clear */
+	char *buf;		/* copy of the shown line */
+	char *next;		/* copy of the line to show */
+	size_t size;
+	char *prompt;		/* copy of the shown prompt */
+	size_t psize;
+	size_t blen;
+	size_t ccur;		/* columns in front of the cursor */
+	size_t width;		/* columns of the line */
+	size_t loverhang;	/* amount of overhanging lines */
+} screen;
+
 static void
 sigwinch(int sig)
 {
@@ -48,14 +169,324 @@ sigwinch(int sig)
 		ioctl(STDOUT_FILENO, TIOCGWINSZ, &winsize);
 }
 
+static void
+sigusr1(int sig)
+{
+	(void)sig;
+	stats_request = 1;
+}
+
+static uint_least64_t
+stats_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		die("clock_gettime:");
+
+	return (uint_least64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static void
 exit_handler(void)
 {
-	/* reset terminal's window name */
+	/* reset terminal's window name and disable bracketed paste */
 	set_title(TERM, TERM);
+	fputs("\033[?2004l", stdout);
+	fflush(stdout);
 
 	if (tcsetattr(STDIN_FILENO, TCSANOW, &origin_term) == -1)
 		die("tcsetattr:");
+
+	for (size_t i = 0; i < nchan; i++)
+		if (chan[i].histfile.path != NULL)
+			histfile_close(&chan[i].histfile);
+}
+
+/* removes the input line, so other output can take its place */
+static void
+screen_erase(void)
+{
+	if (!screen.shown)
+		return;
+
+	/* moves cursor back after linewrap */
+	if (screen.loverhang > 0) {
+		fputs("\r\033[2K", stdout);		/* cr + ... */
+		printf("\033[%zuA", screen.loverhang);	/* x times UP */
+	}
+
+	/* carriage return and erase the whole line */
+	fputs("\r\033[2K", stdout);
+
+	screen.shown = false;
+}
+
+static void
+screen_cursor(size_t col)
+{
+	putchar('\r');
+	/* HACK: because \033[0C does the same as \033[1C */
+	if (col > 0)
+		printf("\033[%zuC", col);
+}
+
+/*
+ * Update the shown input line to the state of sl.  If it is still on the
+ * terminal and fits into one row, only the changed tail of the line gets
+ * rewritten.  Otherwise, the whole line is repainted.
+ */
+static void
+screen_draw(struct slackline *sl, const char *prompt, size_t prompt_len)
+{
+	size_t cols = winsize.ws_col;
+	size_t pw, lw, cw;	/* columns of prompt, line and cursor */
+	char *line, *tmp;
+
+	/* the gap buffer of sl is not a string, get a copy of the line */
+	if (sl->blen + 1 > screen.size) {
+		char *buf = screen.buf;
+
+		screen.size = sl->bufsize;
+		if ((screen.buf = malloc(screen.size)) == NULL)
+			die("malloc:");
+		if (screen.shown)
+			memcpy(screen.buf, buf, screen.blen);
+		free(buf);
+
+		free(screen.next);
+		if ((screen.next = malloc(screen.size)) == NULL)
+			die("malloc:");
+	}
+	sl_copy(sl, screen.next);
+	line = screen.next;
+
+	/* a new prompt needs a repaint of the whole line */
+	if (screen.shown && strcmp(prompt, screen.prompt) != 0)
+		screen_erase();
+	if (prompt_len + 1 > screen.psize) {
+		free(screen.prompt);
+		screen.psize = prompt_len + 1;
+		if ((screen.prompt = malloc(screen.psize)) == NULL)
+			die("malloc:");
+	}
+	memcpy(screen.prompt, prompt, prompt_len + 1);
+
+	/* the cursor is always on a grapheme boundary */
+	pw = width_str(prompt, prompt_len);
+	cw = width_str(line, sl->bcur);
+	lw = cw + width_str(line + sl->bcur, sl->blen - sl->bcur);
+
+	if (screen.shown && pw + screen.width < cols && pw + lw < cols) {
+		size_t byte = 0, col = 0;
+
+		/* skip the graphemes, which are still the same */
+		while (byte < sl->blen && byte < screen.blen) {
+			size_t len = grapheme_next_character_break_utf8(
+			    line + byte, sl->blen - byte);
+
+			if (len != grapheme_next_character_break_utf8(
+			    screen.buf + byte, screen.blen - byte) ||
+			    memcmp(line + byte, screen.buf + byte, len) != 0)
+				break;
+			col += width_str(line + byte, len);
+			byte += len;
+		}
+
+		/* rewrite the rest and erase what is left of the old line */
+		if (byte < sl->blen || byte < screen.blen) {
+			if (screen.ccur != col)
+				screen_cursor(pw + col);
+			fwrite(line + byte, 1, sl->blen - byte, stdout);
+			if (lw < screen.width)
+				fputs("\033[K", stdout);
+			screen.ccur = lw;
+			stats.updates++;
+		}
+
+		if (screen.ccur != cw)
+			screen_cursor(pw + cw);
+	} else {
+		screen_erase();
+		stats.redraws++;
+
+		/* show current input line */
+		fputs(prompt, stdout);
+		fputs(line, stdout);
+
+		/* save amount of overhanging lines */
+		screen.loverhang = (pw + lw) / cols;
+
+		/* correct line wrap handling */
+		if (pw + lw > 0 && (pw + lw) % cols == 0)
+			fputs("\n", stdout);
+
+		if (cw < lw)	/* move the cursor */
+			screen_cursor(pw + cw);
+	}
+
+	/* remember what is on the terminal now */
+	tmp = screen.buf;
+	screen.buf = screen.next;
+	screen.next = tmp;
+	screen.blen = sl->blen;
+	screen.ccur = cw;
+	screen.width = lw;
+	screen.shown = true;
+}
+
+/* print output above the input line and keep it for scrolling back */
+static void
+screen_output(const char *data, size_t n)
+{
+	stats.term_out += n;
+	scrollback_add(&cur->sb, data, n);
+	if (cur->sb.view > 0)
+		return;
+
+	screen_erase();
+	if (fwrite(data, 1, n, stdout) != n)
+		die("fwrite:");
+}
+
+/* write the counters into the directory of the active channel */
+static void
+stats_dump(void)
+{
+	char *path;
+	FILE *fp;
+	int err;
+
+	stats_request = 0;
+	if (asprintf(&path, "%s/.stats", cur->dir) == -1)
+		die("asprintf:");
+	if ((fp = fopen(path, "w")) == NULL)
+		goto fail;
+
+	fprintf(fp, "wakeups %llu\n", stats.wakeups);
+	fprintf(fp, "tty_in %llu\n", stats.tty_in);
+	fprintf(fp, "backend_in %llu\n", stats.backend_in);
+	fprintf(fp, "filter_in %llu\n", stats.filter_in);
+	fprintf(fp, "term_out %llu\n", stats.term_out);
+	fprintf(fp, "filter_out %llu\n", stats.filter_out);
+	fprintf(fp, "backend_out %llu\n", stats.backend_out);
+	fprintf(fp, "redraws %llu\n", stats.redraws);
+	fprintf(fp, "updates %llu\n", stats.updates);
+	fprintf(fp, "bell_lines %llu\n", stats.bell_lines);
+	fprintf(fp, "stalls %llu\n", stats.stalls);
+	if (stats.timed) {
+		fprintf(fp, "bell_us %llu\n",
+		    (unsigned long long)stats.bell_ns / 1000);
+		fprintf(fp, "loop_max_us %llu\n",
+		    (unsigned long long)stats.loop_ns / 1000);
+	}
+
+	err = ferror(fp);
+	if (fclose(fp) == EOF || err)
+		goto fail;
+	free(path);
+	stats.timed = true;
+	return;
+ fail:
+	/* a failed dump is no reason to end the session */
+	screen_erase();
+	fflush(stdout);
+	fprintf(stderr, "stats_dump: %s: %s\n", path, strerror(errno));
+	free(path);
+}
+
+/* terminal rows of an output line, escape sequences take no space */
+static size_t
+line_rows(const char *line, size_t len, size_t cols)
+{
+	size_t w = 0;
+
+	for (size_t i = 0, n; i < len; i = n) {
+		if (line[i] == '\033') {
+			n = i + 1;
+			if (n < len && line[n] == '[')
+				while (++n < len && (line[n] < 0x40 ||
+				    line[n] > 0x7e))
+					;
+			if (n < len)
+				n++;
+			continue;
+		}
+		for (n = i; n < len && line[n] != '\033'; n++)
+			;
+		w += width_str(line + i, n - i);
+	}
+
+	return w > cols ? (w + cols - 1) / cols : 1;
+}
+
+/*
+ * Scroll the output by pages, negative ones go back.  The screen gets
+ * cleared and filled with the lines in front of the view.
+ */
+static void
+screen_page(int pages)
+{
+	struct scrollback *sb = &cur->sb;
+	size_t rows = winsize.ws_row > 1 ? winsize.ws_row - 1 : 1;
+	size_t cols = winsize.ws_col > 0 ? winsize.ws_col : 80;
+	size_t start, end, used = 0, len;
+	const char *line;
+
+	if (pages < 0)
+		sb->view += (size_t)-pages * rows;
+	else if ((size_t)pages * rows < sb->view)
+		sb->view -= (size_t)pages * rows;
+	else
+		sb->view = 0;
+	if (sb->view > sb->count)
+		sb->view = sb->count;
+
+	end = start = sb->count - sb->view;
+	while (start > 0) {
+		line = scrollback_line(sb, start - 1, &len);
+		if (used + line_rows(line, len, cols) > rows)
+			break;
+		used += line_rows(line, len, cols);
+		start--;
+	}
+
+	/* the oldest line is on top, fill the rest of the screen */
+	while (start == 0 && end < sb->count) {
+		line = scrollback_line(sb, end, &len);
+		if (used + line_rows(line, len, cols) > rows)
+			break;
+		used += line_rows(line, len, cols);
+		end++;
+	}
+	sb->view = sb->count - end;
+
+	fputs("\033[H\033[2J", stdout);
+	for (size_t i = start; i < end; i++) {
+		line = scrollback_line(sb, i, &len);
+		fwrite(line, 1, len, stdout);
+		putchar('\n');
+	}
+	fputs("\033[0m", stdout);
+	screen.shown = false;
+}
+
+/* returns the milliseconds until the erased input line may be repainted */
+static int
+frame_delay(void)
+{
+	struct timespec now;
+	long ms;
+
+	if (fps == 0 || screen.shown)
+		return 0;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+		die("clock_gettime:");
+	ms = (now.tv_sec - frame.tv_sec) * 1000 +
+	    (now.tv_nsec - frame.tv_nsec) / 1000000;
+
+	return ms >= 1000 / fps ? 0 : 1000 / fps - ms;
 }
 
 static char *
@@ -87,19 +518,125 @@ read_file_line(const char *file)
 	return line;
 }
 
+static void outq_event(int, int, void *);
+
+/* forget the in file, the next line_output() opens it again */
 static void
-line_output(struct slackline *sl, char *file)
+outq_close(struct outq *o)
 {
-	int fd;
+	if (o->event)
+		event_del(o->fd);
+	if (close(o->fd) == -1)
+		die("close:");
+	o->fd = -1;
+	o->event = false;
+}
 
-	if ((fd = open(file, O_WRONLY|O_APPEND)) == -1)
-		die("open: %s:", file);
+/*
+ * Write queued lines to the backend without blocking.  The in file stays
+ * open between calls.  If the reader of its FIFO went away, it is reopened
+ * by a later call.
+ */
+static void
+line_output(struct outq *o)
+{
+	const char *data = o->q.buf + o->q.off;
+	ssize_t n;
+
+	if (o->fd == -1) {
+		if ((o->fd = open(o->file,
+		    O_WRONLY|O_APPEND|O_NONBLOCK|O_CLOEXEC)) == -1) {
+			if (errno == ENXIO)	/* FIFO without reader */
+				return;
+			die("open: %s:", o->file);
+		}
+		o->event = event_add(o->fd, 0, outq_event, o) == 0;
+	}
 
-	if (write(fd, sl->buf, sl->blen) == -1)
-		die("write:");
+	if ((n = queue_write(&o->q, o->fd)) == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			goto out;
+		if (errno != EPIPE || o->file == NULL)
+			die("write:");
+		outq_close(o);
+		return;
+	}
 
-	if (close(fd) == -1)
-		die("close:");
+	stats.backend_out += n;
+	for (ssize_t i = 0; i < n; i++)
+		if (data[i] == '\n')
+			o->lines--;
+ out:
+	/* wait until the backend takes the rest */
+	if (o->event)
+		event_mod(o->fd, o->q.len > 0 ? EVENT_OUT : 0);
+}
+
+/* keep the offset of the next snprintf() inside of a buffer of size */
+static int
+prompt_clamp(int n, size_t size)
+{
+	if (n < 0)
+		return 0;
+	if ((size_t)n >= size)
+		return size - 1;
+	return n;
+}
+
+/*
+ * Returns the prompt with the state of the search and the queue.  With
+ * several channels, it starts with the name of the active one and the
+ * amount of other channels with unseen output.
+ */
+static const char *
+state_prompt(struct channel *c, const char *prompt, char *buf,
+    size_t size)
+{
+	struct slackline *sl = c->sl;
+	size_t unseen = 0;
+	int n = 0;
+
+	if (nchan == 1 && c->outq.lines == 0 && !sl->hist.search &&
+	    c->sb.view == 0)
+		return prompt;
+
+	for (size_t i = 0; i < nchan; i++)
+		if (chan[i].unseen)
+			unseen++;
+
+	if (nchan > 1 && unseen > 0)
+		n = snprintf(buf, size, "%s +%zu ", c->dir, unseen);
+	else if (nchan > 1)
+		n = snprintf(buf, size, "%s ", c->dir);
+	n = prompt_clamp(n, size);
+
+	if (c->sb.view > 0) {
+		n += snprintf(buf + n, size - n, "(%zu below) ", c->sb.view);
+		n = prompt_clamp(n, size);
+	}
+	if (c->outq.lines > 0) {
+		n += snprintf(buf + n, size - n, "[%zu] ", c->outq.lines);
+		n = prompt_clamp(n, size);
+	}
+
+	if (sl->hist.search)
+		snprintf(buf + n, size - n, "(%sreverse-i-search)`%.*s': ",
+		    sl->hist.failed ? "failing " : "",
+		    (int)sl->hist.qlen, sl->hist.query);
+	else
+		snprintf(buf + n, size - n, "%s", prompt);
+
+	return buf;
+}
+
+static void
+set_nonblock(int fd)
+{
+	int flags;
+
+	if ((flags = fcntl(fd, F_GETFL)) == -1 ||
+	    fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		die("fcntl:");
 }
 
 static void
@@ -113,6 +650,10 @@ fork_filter(int *read, int *write)
 	if (pipe(fds_write) == -1)
 		die("pipe:");
 
+	/* don't duplicate buffered output into the child */
+	if (fflush(stdout) == EOF)
+		die("fflush:");
+
 	switch (fork()) {
 	case -1:
 		die("fork of .filter");
@@ -138,53 +679,427 @@ fork_filter(int *read, int *write)
 	if (close(fds_write[0]) == -1)
 		die("close:");
 
+	/* a slow .filter must not block the terminal */
+	set_nonblock(fds_read[0]);
+	set_nonblock(fds_write[1]);
+
+	/* the .filter of the next channel must not keep these pipes open */
+	if (fcntl(fds_read[0], F_SETFD, FD_CLOEXEC) == -1 ||
+	    fcntl(fds_write[1], F_SETFD, FD_CLOEXEC) == -1)
+		die("fcntl:");
+
 	*read = fds_read[0];
 	*write = fds_write[1];
 }
 
+/* load a .filter.so, which replaces the forked .filter */
+static void
+plugin_open(const char *path)
+{
+	if ((plugin.handle = dlopen(path, RTLD_NOW|RTLD_LOCAL)) == NULL)
+		die("dlopen: %s", dlerror());
+
+	/* the POSIX way to get function pointers out of dlsym(3) */
+	*(void **)&plugin.init = dlsym(plugin.handle, "filter_init");
+	*(void **)&plugin.line = dlsym(plugin.handle, "filter_line");
+	*(void **)&plugin.flush = dlsym(plugin.handle, "filter_flush");
+
+	if (plugin.line == NULL)
+		die("%s: missing filter_line", path);
+	if (plugin.init != NULL && plugin.init() == -1)
+		die("%s: filter_init failed", path);
+
+	/* the output goes to the terminal and into the scrollback */
+	if ((plugin.out = open_memstream(&plugin.buf, &plugin.len)) == NULL)
+		die("open_memstream:");
+}
+
+/* forward queued backend data to the .filter of c without blocking */
+static void
+filter_output(struct channel *c)
+{
+	if (queue_write(&c->filterq, c->sink) == -1 && errno != EAGAIN &&
+	    errno != EINTR) {
+		if (errno == EPIPE)
+			die(".filter exited");
+		die("write:");
+	}
+
+	event_mod(c->sink, c->filterq.len > 0 ? EVENT_OUT : 0);
+}
+
+/* output of an inactive channel just goes into its scrollback */
+static void
+channel_output(struct channel *c, const char *data, size_t n)
+{
+	if (c == cur)
+		screen_output(data, n);
+	else
+		scrollback_add(&c->sb, data, n);
+}
+
+static void
+backend_input(struct channel *c, const char *data, size_t n)
+{
+	bool ring = false;
+	char *line;
+
+	stats.backend_in += n;
+
+	/* the terminal gets the data with the rest of the frame */
+	if (plugin.handle == NULL && c->sink == STDOUT_FILENO) {
+		channel_output(c, data, n);
+	} else if (plugin.handle == NULL) {
+		queue_push(&c->filterq, data, n);
+		stats.filter_out += n;
+		filter_output(c);
+	}
+
+	if (bell == NULL && plugin.handle == NULL)
+		return;
+
+	/* without notifications, check for changes by stat(2) */
+	if (bell != NULL && bell->watch.fd == -1)
+		bell_update(bell);
+
+	/* match every complete line once, no matter how it was read */
+	while ((line = linebuf_next(&c->lb, &data, &n)) != NULL) {
+		if (bell != NULL && !ring) {
+			uint_least64_t t = stats.timed ? stats_now() : 0;
+
+			ring = bell_match(bell, line);
+			stats.bell_lines++;
+			if (stats.timed)
+				stats.bell_ns += stats_now() - t;
+		}
+		if (plugin.handle != NULL)
+			plugin.line(plugin.out, line);
+	}
+
+	if (plugin.flush != NULL)
+		plugin.flush(plugin.out);
+
+	/* pass the output of the plugin on and reuse its buffer */
+	if (plugin.handle != NULL) {
+		if (fflush(plugin.out) == EOF)
+			die("fflush:");
+		stats.filter_in += plugin.len;
+		if (plugin.len > 0)
+			channel_output(c, plugin.buf, plugin.len);
+		rewind(plugin.out);
+	}
+
+	/* ring the bell on external input */
+	if (ring)
+		putchar('\a');
+}
+
+/*
+ * Make the next channel with unseen output active.  Without such a
+ * channel, just take the next one.
+ */
+static void
+channel_next(void)
+{
+	size_t next = (cur - chan + 1) % nchan;
+
+	for (size_t n = 1; n < nchan; n++) {
+		size_t i = (cur - chan + n) % nchan;
+
+		if (chan[i].unseen) {
+			next = i;
+			break;
+		}
+	}
+
+	cur = &chan[next];
+	cur->unseen = false;
+}
+
+/* returns true, if the out file of c has data, which may be read now */
+static bool
+channel_ready(struct channel *c)
+{
+	return c->pending && !c->sink_full && c->filterq.len < FILTERQ_SIZE;
+}
+
 static void
 usage(void)
 {
-	die("lchat [-aeh] [-n lines] [-p prompt] [-t title] [-i in] [-o out]"
-	    " [directory]");
+	die("lchat [-aeh] [-n lines] [-p prompt] [-q size] [-r fps] [-t title]"
+	    " [-i in] [-o out] [directory ...]");
+}
+
+/* handle keyboard input */
+static void
+tty_event(int fd, int events, void *arg)
+{
+	struct slackline *sl = cur->sl;
+	char buf[BUFSIZ];
+	ssize_t ret;
+
+	(void)events;
+	(void)arg;
+
+	if ((ret = read(fd, buf, sizeof buf)) == -1)
+		die("read:");
+
+	if (ret == 0)
+		exit(EXIT_SUCCESS);
+	stats.tty_in += ret;
+
+	for (ssize_t i = 0; i < ret; i++) {
+		size_t n;
+
+		switch (buf[i]) {
+		case 13:	/* return */
+			if (sl->rlen == 0 && empty_line == false)
+				continue;
+
+			/* keep the line, if the queue is full */
+			if (cur->outq.q.len + sl->blen + 1 > outq_max) {
+				putchar('\a');
+				continue;
+			}
+
+			if (sl_history_add(sl, sl_buf(sl), sl->blen) == -1)
+				die("sl_history_add");
+
+			/* replace NUL-terminator with newline */
+			sl->buf[sl->blen++] = '\n';
+			queue_push(&cur->outq.q, sl->buf, sl->blen);
+			cur->outq.lines++;
+			histfile_append(&cur->histfile, sl->buf, sl->blen);
+			sl_reset(sl);
+			continue;
+		case 12: /* ctrl+l -- clear screen, same as clear(1) */
+			if (sl->paste)
+				break;
+			fputs("\x1b[2J\x1b[H", stdout);
+			screen.shown = false;
+			continue;
+		case 15: /* ctrl+o -- switch to the next channel */
+			if (sl->paste)
+				break;
+			if (nchan == 1)
+				continue;
+			channel_next();
+			sl = cur->sl;
+			set_title(TERM, title != NULL ? title : cur->dir);
+
+			/* show the lines of the new channel */
+			screen_page(0);
+			continue;
+		}
+
+		/* pass everything up to the next special key */
+		for (n = 1; i + n < (size_t)ret; n++)
+			if (buf[i + n] == 13 || buf[i + n] == 12 ||
+			    buf[i + n] == 15)
+				break;
+		if (sl_input(sl, buf + i, n) == -1)
+			die("sl_input");
+		i += n - 1;
+
+		/* PageUp and PageDown */
+		if (sl->page != 0) {
+			screen_page(sl->page);
+			sl->page = 0;
+		}
+	}
+
+	/* send all lines of this chunk at once */
+	for (size_t i = 0; i < nchan; i++)
+		if (chan[i].outq.q.len > 0)
+			line_output(&chan[i].outq);
+}
+
+#ifdef __linux__
+/* a full .filter pipe waits for sink_event(), others fall back to read(2) */
+static void
+splice_failed(struct channel *c)
+{
+	if (errno != EAGAIN) {
+		zerocopy = false;
+		return;
+	}
+	c->sink_full = true;
+	event_mod(c->sink, EVENT_OUT);
+}
+#endif
+
+/* handle the input of an ucspi backend */
+static void
+backend_event(int fd, int events, void *arg)
+{
+	char buf[BUFSIZ];
+	ssize_t n;
+
+	(void)arg;
+
+	/* handle backend error and its broken pipe */
+	if (events & EVENT_HUP)
+		exit(EXIT_SUCCESS);
+	if (events & EVENT_ERR)
+		die("backend error");
+
+#ifdef __linux__
+	if (zerocopy && cur->filterq.len == 0) {
+		while ((n = splice(fd, NULL, cur->sink, NULL, DRAIN_SIZE,
+		    SPLICE_F_MOVE|SPLICE_F_NONBLOCK)) == -1 && errno == EINTR)
+			;
+		if (n == 0)
+			die("backend exited");
+		if (n == -1) {
+			int avail, err = errno;
+
+			/* the socket may be empty instead of the pipe full */
+			if (err == EAGAIN && ioctl(fd, FIONREAD, &avail) == 0 &&
+			    avail == 0)
+				return;
+			errno = err;
+			splice_failed(cur);
+			return;
+		}
+		stats.backend_in += n;
+		stats.filter_out += n;
+		return;
+	}
+#endif
+
+	if ((n = read(fd, buf, sizeof buf)) == 0)
+		die("backend exited");
+	if (n == -1)
+		die("read:");
+	backend_input(cur, buf, n);
+}
+
+/* handle the output of the .filter of a channel */
+static void
+filter_event(int fd, int events, void *arg)
+{
+	struct channel *c = arg;
+	char buf[BUFSIZ];
+	ssize_t n;
+
+	/* handle .filter error and its broken pipe */
+	if (events & EVENT_HUP)
+		exit(EXIT_SUCCESS);
+	if (events & EVENT_ERR)
+		die(".filter error");
+
+	/* take all of it, before the input line gets repainted */
+	for (size_t got = 0; got < DRAIN_SIZE; got += n) {
+		if ((n = read(fd, buf, sizeof buf)) == 0)
+			die(".filter exited");
+		if (n == -1 && errno == EAGAIN)
+			break;
+		if (n == -1)
+			die("read:");
+		stats.filter_in += n;
+		channel_output(c, buf, n);
+	}
+}
+
+/* the .filter of a channel is ready for more backend data */
+static void
+sink_event(int fd, int events, void *arg)
+{
+	struct channel *c = arg;
+
+	(void)fd;
+	(void)events;
+
+	c->sink_full = false;
+	filter_output(c);
+}
+
+/* the backend is ready for more queued lines */
+static void
+outq_event(int fd, int events, void *arg)
+{
+	struct outq *o = arg;
+
+	(void)fd;
+
+	/*
+	 * Errors are reported, even if we wait for nothing.  A FIFO without
+	 * reader would wake us up all the time, so close it until the next
+	 * line is submitted.
+	 */
+	if (events & (EVENT_HUP|EVENT_ERR)) {
+		if (o->file == NULL && events & EVENT_HUP)
+			exit(EXIT_SUCCESS);
+		if (o->file == NULL)
+			die("backend error");
+		outq_close(o);
+		return;
+	}
+
+	line_output(o);
+}
+
+/* reload changed .bellmatch */
+static void
+bell_event(int fd, int events, void *arg)
+{
+	(void)fd;
+	(void)events;
+	(void)arg;
+
+	bell_update(bell);
+}
+
+/* the out file of channel arg has changed */
+static void
+watch_event(int fd, int events, void *arg)
+{
+	struct channel *c = arg;
+
+	(void)fd;
+	(void)events;
+
+	if (watch_check(&c->follow.watch)) {
+		c->pending = true;
+		if (c != cur)
+			c->unseen = true;
+	}
 }
 
 int
 main(int argc, char *argv[])
 {
-	struct pollfd pfd[3];
 	struct termios term;
-	struct slackline *sl = sl_init();
 	int fd = STDIN_FILENO;
-	int read_fd = 6;
 	int read_filter = -1;
-	int backend_sink = STDOUT_FILENO;
-	char c;
 	int ch;
-	bool empty_line = false;
 	bool bell_flag = true;
 	bool ucspi = false;
-	char *bell_file = ".bellmatch";
+	bool polling;		/* no change notifications of out files */
+	int delay = 0;		/* until the next frame */
+	bool stalled = false;	/* the .filter was full in the last loop */
+	size_t got;		/* backend data read in this loop */
+	uint_least64_t woke = 0;	/* end of the last wait, if timed */
+	enum mode mode = SL_DEFAULT;
+	bool mode_flag = false;	/* mode overrides EDITOR */
 	size_t history_len = 5;
 	char *prompt = read_file_line(".prompt");
-	char *title = read_file_line(".title");
 
+	title = read_file_line(".title");
 	if ((TERM = getenv("TERM")) == NULL)
 		TERM = "";
 
-	if (sl == NULL)
-		die("Failed to initialize slackline");
-
 	if (prompt == NULL)	/* set default prompt */
 		prompt = "> ";
 
 	size_t prompt_len = strlen(prompt);
-	size_t loverhang = 0;
 	char *dir = ".";
 	char *in_file = NULL;
 	char *out_file = NULL;
+	char *pbuf;		/* prompt with state information */
+	size_t psize;
 
-	while ((ch = getopt(argc, argv, "an:i:eo:p:t:uhm:")) != -1) {
+	while ((ch = getopt(argc, argv, "an:i:eo:p:q:r:t:uhm:")) != -1) {
 		switch (ch) {
 		case 'a':
 			bell_flag = false;
@@ -211,6 +1126,18 @@ main(int argc, char *argv[])
 				die("strdup:");
 			prompt_len = strlen(prompt);
 			break;
+		case 'q':
+			errno = 0;
+			outq_max = strtoull(optarg, NULL, 0);
+			if (errno != 0)
+				die("strtoull:");
+			break;
+		case 'r':
+			errno = 0;
+			fps = strtoul(optarg, NULL, 0);
+			if (errno != 0)
+				die("strtoul:");
+			break;
 		case 't':
 			if ((title = strdup(optarg)) == NULL)
 				die("strdup:");
@@ -220,9 +1147,12 @@ main(int argc, char *argv[])
 			break;
 		case 'm':
 			if (strcmp(optarg, "emacs") == 0)
-				sl_mode(sl, SL_EMACS);
+				mode = SL_EMACS;
+			else if (strcmp(optarg, "vi") == 0)
+				mode = SL_VI;
 			else
 				die("lchat: invalid mode");
+			mode_flag = true;
 			break;
 		case 'h':
 		default:
@@ -233,33 +1163,59 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
-	if (argc > 1)
-		usage();
-
-	if (argc == 1)
-		if ((dir = strdup(argv[0])) == NULL)
+	/* several directories share this process and its terminal */
+	nchan = argc > 1 ? argc : 1;
+	if (nchan > 1 && (ucspi || in_file != NULL || out_file != NULL))
+		die("lchat: -u, -i and -o need a single directory");
+	if ((chan = calloc(nchan, sizeof *chan)) == NULL)
+		die("calloc:");
+	cur = chan;
+
+	psize = prompt_len + sizeof chan->sl->hist.query + 64;
+	for (size_t i = 0; i < nchan; i++) {
+		struct channel *c = &chan[i];
+		char *history_file;
+
+		if (argc > 0)
+			dir = argv[i];
+		if ((c->dir = strdup(dir)) == NULL)
 			die("strdup:");
-
-	if (in_file == NULL)
-		if (asprintf(&in_file, "%s/in", dir) == -1)
+		psize += strlen(c->dir);
+
+		if ((c->sl = sl_init()) == NULL)
+			die("Failed to initialize slackline");
+		if (mode_flag)
+			sl_mode(c->sl, mode);
+
+		c->sink = STDOUT_FILENO;
+		c->outq.fd = -1;
+		c->outq.file = in_file;
+		if (in_file == NULL &&
+		    asprintf(&c->outq.file, "%s/in", dir) == -1)
 			die("asprintf:");
 
-	if (out_file == NULL)
-		if (asprintf(&out_file, "%s/out", dir) == -1)
+		/* the history of former sessions is loaded on its first use */
+		if (asprintf(&history_file, "%s/.history", dir) == -1)
 			die("asprintf:");
+		histfile_open(&c->histfile, history_file);
+		sl_history_source(c->sl, c->histfile.map, c->histfile.maplen);
+		free(history_file);
+	}
+	if ((pbuf = malloc(psize)) == NULL)
+		die("malloc:");
 
 	if (isatty(fd) == 0)
 		die("isatty:");
 
 	/* set terminal's window title */
-	if (title == NULL) {
+	if (title == NULL && nchan == 1) {
 		char path[PATH_MAX];
 		if (getcwd(path, sizeof path) == NULL)
 			die("getcwd:");
 		if ((title = basename(path)) == NULL)
 			die("basename:");
 	}
-	set_title(TERM, title);
+	set_title(TERM, title != NULL ? title : cur->dir);
 
 	/* prepare terminal reset on exit */
 	if (tcgetattr(fd, &origin_term) == -1)
@@ -284,158 +1240,198 @@ main(int argc, char *argv[])
 	sigwinch(SIGWINCH);
 	signal(SIGWINCH, sigwinch);
 
-	setbuf(stdin, NULL);
-	setbuf(stdout, NULL);
-
-	if (!ucspi) {
-		char tail_cmd[BUFSIZ];
-		FILE *fh;
+	/* a vanished reader of the in FIFO is reported by EPIPE */
+	signal(SIGPIPE, SIG_IGN);
 
-		/* open external source */
-		snprintf(tail_cmd, sizeof tail_cmd, "exec tail -n %zu -f %s",
-		    history_len, out_file);
+	/* dump the counters into .stats */
+	signal(SIGUSR1, sigusr1);
 
-		if ((fh = popen(tail_cmd, "r")) == NULL)
-			die("unable to open pipe to tail:");
+	/*
+	 * Collect all output of a loop iteration in the stdout buffer, so
+	 * the whole redraw reaches the terminal with a single write(2).
+	 */
+	setbuf(stdin, NULL);
+	if (setvbuf(stdout, NULL, _IOFBF, OUTBUF_SIZE) != 0)
+		die("setvbuf:");
 
-		read_fd = fileno(fh);
-	}
+	/* every source of input calls back from event_wait() */
+	event_init();
+	event_add(fd, EVENT_IN, tty_event, NULL);
 
-	int nfds = 2;
+	/* follow the out files like tail -f */
+	for (size_t i = 0; i < nchan && !ucspi; i++) {
+		struct channel *c = &chan[i];
+		char *out = out_file;
 
-	pfd[0].fd = fd;
-	pfd[0].events = POLLIN;
+		if (out == NULL && asprintf(&out, "%s/out", c->dir) == -1)
+			die("asprintf:");
+		follow_open(&c->follow, out, history_len);
+		c->pending = true;
+		if (c->follow.watch.fd != -1)
+			event_add(c->follow.watch.fd, EVENT_IN, watch_event, c);
+	}
+	polling = !ucspi && chan->follow.watch.fd == -1;
+
+	/* prefer the in-process filter */
+	if (access(".filter.so", R_OK) == 0) {
+		plugin_open("./.filter.so");
+	} else if (access(".filter", X_OK) == 0) {
+		for (size_t i = 0; i < nchan; i++) {
+			struct channel *c = &chan[i];
+
+			fork_filter(&read_filter, &c->sink);
+			event_add(read_filter, EVENT_IN, filter_event, c);
+			event_add(c->sink, 0, sink_event, c);
+		}
+	}
 
-	pfd[1].fd = read_fd;
-	pfd[1].events = POLLIN;
+	/* the outgoing queue is written, when the backend is ready */
+	if (ucspi) {
+		event_add(6, EVENT_IN, backend_event, NULL);
+		chan->outq.fd = 7;
+		chan->outq.file = NULL;
+		set_nonblock(chan->outq.fd);
+		chan->outq.event = event_add(chan->outq.fd, 0, outq_event,
+		    &chan->outq) == 0;
+	}
 
-	if (access(".filter", X_OK) == 0) {
-		fork_filter(&read_filter, &backend_sink);
+	/* watch .bellmatch for changes */
+	if (bell_flag) {
+		bell = bell_init(".bellmatch", true);
+		if (bell->watch.fd != -1)
+			event_add(bell->watch.fd, EVENT_IN, bell_event, NULL);
+	}
 
-		pfd[2].fd = read_filter;
-		pfd[2].events = POLLIN;
+#ifdef __linux__
+	zerocopy = bell == NULL && plugin.handle == NULL &&
+	    chan->sink != STDOUT_FILENO;
+#endif
 
-		nfds = 3;
-	}
+	/* let the terminal mark pasted text */
+	fputs("\033[?2004h", stdout);
 
 	/* print initial prompt */
-	fputs(prompt, stdout);
+	const char *p = state_prompt(cur, prompt, pbuf, psize);
+	screen_draw(cur->sl, p, p == prompt ? prompt_len : strlen(p));
 
 	for (;;) {
 		if (fflush(stdout) == EOF)
 			die("fflush:");
+		if (stats.timed && woke > 0) {
+			uint_least64_t t = stats_now() - woke;
 
-		errno = 0;
-		if (poll(pfd, nfds, INFTIM) == -1 && errno != EINTR)
-			die("poll:");
-
-		/* moves cursor back after linewrap */
-		if (loverhang > 0) {
-			fputs("\r\033[2K", stdout);	/* cr + ... */
-			printf("\033[%zuA", loverhang);	/* x times UP */
+			if (t > stats.loop_ns)
+				stats.loop_ns = t;
 		}
 
-		/* carriage return and erase the whole line */
-		fputs("\r\033[2K", stdout);
-
-		/* handle keyboard intput */
-		if (pfd[0].revents & POLLIN) {
-			ssize_t ret = read(fd, &c, sizeof c);
-
-			if (ret == -1)
-				die("read:");
-
-			if (ret == 0)
-				return EXIT_SUCCESS;
-
-			switch (c) {
-			case 13:	/* return */
-				if (sl->rlen == 0 && empty_line == false)
-					goto out;
-				/* replace NUL-terminator with newline */
-				sl->buf[sl->blen++] = '\n';
-				if (ucspi) {
-					if (write(7, sl->buf, sl->blen) == -1)
-						die("write:");
-				} else {
-					line_output(sl, in_file);
-				}
-				sl_reset(sl);
-				break;
-			case 12: /* ctrl+l -- clear screen, same as clear(1) */
-				fputs("\x1b[2J\x1b[H", stdout);
-				break;
-			default:
-				if (sl_keystroke(sl, c) == -1)
-					die("sl_keystroke");
+		/*
+		 * Without change notifications, look for new data of the out
+		 * file once a second, like tail(1) does.
+		 */
+		bool filter_full = false;
+		for (size_t i = 0; i < nchan; i++)
+			filter_full = filter_full || chan[i].sink_full ||
+			    chan[i].filterq.len >= FILTERQ_SIZE;
+		if (filter_full && !stalled)
+			stats.stalls++;
+		stalled = filter_full;
+
+		int timeout = INFTIM;
+		bool ready = false;
+		for (size_t i = 0; i < nchan; i++)
+			ready = ready || channel_ready(&chan[i]);
+		if (ready)
+			timeout = 0;
+		else if (delay > 0)
+			timeout = delay;	/* the next frame */
+		else if (polling)
+			timeout = 1000;
+
+		/* wait for a FIFO reader */
+		for (size_t i = 0; i < nchan; i++)
+			if (chan[i].outq.q.len > 0 && !chan[i].outq.event)
+				timeout = 1000;
+
+		/* a busy .filter holds back further backend input */
+		if (ucspi)
+			event_mod(6, filter_full ? 0 : EVENT_IN);
+
+		event_wait(timeout);
+		stats.wakeups++;
+		if (stats_request)
+			stats_dump();
+		if (stats.timed)
+			woke = stats_now();
+
+		/* retry the queues without a watched descriptor */
+		for (size_t i = 0; i < nchan; i++)
+			if (chan[i].outq.q.len > 0 && !chan[i].outq.event)
+				line_output(&chan[i].outq);
+
+		/* without notifications, look at all out files */
+		for (size_t i = 0; polling && i < nchan; i++) {
+			struct channel *c = &chan[i];
+
+			if (watch_check(&c->follow.watch)) {
+				c->pending = true;
+				if (c != cur)
+					c->unseen = true;
+			} else if (c == cur) {
+				c->pending = true;
 			}
 		}
 
-		/* handle backend error and its broken pipe */
-		if (pfd[1].revents & POLLHUP)
-			break;
-		if (pfd[1].revents & POLLERR || pfd[1].revents & POLLNVAL)
-			die("backend error");
+		/*
+		 * Drain the out files, but keep an eye on the keyboard.  The
+		 * active channel goes first, the others are read for the bell
+		 * and their scrollback.
+		 */
+		got = 0;
+		for (size_t k = 0; k < nchan && got < DRAIN_SIZE; k++) {
+			struct channel *c = &chan[(cur - chan + k) % nchan];
 
-		/* handle backend input */
-		if (pfd[1].revents & POLLIN) {
-			char buf[BUFSIZ];
-			ssize_t n = read(pfd[1].fd, buf, sizeof buf);
-			if (n == 0)
-				die("backend exited");
-			if (n == -1)
-				die("read:");
-			if (write(backend_sink, buf, n) == -1)
-				die("write:");
-
-			/* terminate the input buffer with NUL */
-			buf[n == BUFSIZ ? n - 1 : n] = '\0';
-
-			/* ring the bell on external input */
-			if (bell_flag && bell_match(buf, bell_file))
-				putchar('\a');
-		}
-
-		/* handel optional .filter i/o */
-		if (nfds > 2) {
-			/* handle .filter error and its broken pipe */
-			if (pfd[2].revents & POLLHUP)
-				break;
-			if (pfd[2].revents & POLLERR ||
-			    pfd[2].revents & POLLNVAL)
-				die(".filter error");
-
-			/* handle .filter output */
-			if (pfd[2].revents & POLLIN) {
+			while (got < DRAIN_SIZE && channel_ready(c)) {
 				char buf[BUFSIZ];
-				ssize_t n = read(pfd[2].fd, buf, sizeof buf);
+				const char *data = buf;
+				ssize_t n;
+
+				n = follow_history(&c->follow, &data,
+				    sizeof buf);
+#ifdef __linux__
+				if (n == 0 && zerocopy && c->filterq.len == 0) {
+					if ((n = follow_splice(&c->follow,
+					    c->sink, DRAIN_SIZE - got)) == -1) {
+						splice_failed(c);
+						continue;
+					}
+					if (n == 0)
+						c->pending = false;
+					stats.backend_in += n;
+					stats.filter_out += n;
+					got += n;
+					continue;
+				}
+#endif
 				if (n == 0)
-					die(".filter exited");
-				if (n == -1)
-					die("read:");
-				if (write(STDOUT_FILENO, buf, n) == -1)
-					die("write:");
+					n = follow_read(&c->follow, buf,
+					    sizeof buf);
+				if (n > 0)
+					backend_input(c, data, n);
+				else
+					c->pending = false;
+				got += n;
 			}
 		}
- out:
-		/* show current input line */
-		fputs(prompt, stdout);
-		fputs(sl->buf, stdout);
 
-		/* save amount of overhanging lines */
-		loverhang = (prompt_len + sl->rlen) / winsize.ws_col;
+		/* during a flood, repaint the input line once per frame */
+		if ((delay = frame_delay()) > 0)
+			continue;
+		if (!screen.shown && fps > 0 &&
+		    clock_gettime(CLOCK_MONOTONIC, &frame) == -1)
+			die("clock_gettime:");
 
-		/* correct line wrap handling */
-		if ((prompt_len + sl->rlen) > 0 &&
-		    (prompt_len + sl->rlen) % winsize.ws_col == 0)
-			fputs("\n", stdout);
-
-		if (sl->rcur < sl->rlen) {	/* move the cursor */
-			putchar('\r');
-			/* HACK: because \033[0C does the same as \033[1C */
-			if (sl->rcur + prompt_len > 0)
-				printf("\033[%zuC", sl->rcur + prompt_len);
-		}
+		p = state_prompt(cur, prompt, pbuf, psize);
+		screen_draw(cur->sl, p, p == prompt ? prompt_len : strlen(p));
 	}
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,388 @@
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <regex.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+
+/*
+ * The flood never contains the probe key, so its echo is easy to spot.  A
+ * backspace removes it again, before the next probe is typed.
+ */
+#define PROBE_KEY	'z'
+#define PROBE_GAP	(20 * 1000 * 1000)	/* ns between two probes */
+#define PROBE_MAX	65536
+
+/* give up, if lchat falls behind the flood for this time */
+#define BENCH_WAIT	(10 * 1000 * 1000 * 1000ULL)
+
+struct run {
+	bool ucspi;	/* backend on fd 6 and 7 instead of the out file */
+	bool bell;
+	bool filter;
+};
+
+static char *lchat;
+static size_t nlines = 40000;
+static unsigned long rate = 20000;	/* lines per second, 0 for no limit */
+static char dir[] = "/tmp/lchat_bench.XXXXXX";
+
+static const char *const files[] = {
+	"in", "out", ".history", ".bellmatch", ".filter"
+};
+
+static uint_least64_t latency[PROBE_MAX];
+static size_t nlatency;
+
+static uint_least64_t
+now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		die("clock_gettime:");
+
+	return (uint_least64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+put_file(const char *name, const char *content, mode_t mode)
+{
+	int fd;
+
+	if ((fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, mode)) == -1)
+		die("open: %s:", name);
+	if (write(fd, content, strlen(content)) == -1)
+		die("write: %s:", name);
+	if (close(fd) == -1)
+		die("close:");
+}
+
+static void
+clean(void)
+{
+	struct dirent *de;
+	DIR *d;
+
+	for (size_t i = 0; i < sizeof files / sizeof *files; i++)
+		if (unlink(files[i]) == -1 && errno != ENOENT)
+			die("unlink: %s:", files[i]);
+
+	/* temporary files of an interrupted compaction of .history */
+	if ((d = opendir(".")) == NULL)
+		die("opendir:");
+	while ((de = readdir(d)) != NULL)
+		if (strncmp(de->d_name, ".history.", 9) == 0 &&
+		    unlink(de->d_name) == -1)
+			die("unlink: %s:", de->d_name);
+	if (closedir(d) == -1)
+		die("closedir:");
+}
+
+/* start lchat on a new pseudo terminal and return its master side */
+static pid_t
+spawn(const struct run *r, int *master, int *backend)
+{
+	struct winsize ws = {.ws_row = 24, .ws_col = 80};
+	char *argv[5];
+	int sv[2], argc = 0, slave;
+	pid_t pid;
+
+	if ((*master = posix_openpt(O_RDWR|O_NOCTTY)) == -1)
+		die("posix_openpt:");
+	if (grantpt(*master) == -1 || unlockpt(*master) == -1)
+		die("grantpt:");
+	if (r->ucspi && socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+		die("socketpair:");
+
+	argv[argc++] = "lchat";
+	if (!r->bell)
+		argv[argc++] = "-a";
+	argv[argc++] = r->ucspi ? "-u" : ".";
+	argv[argc] = NULL;
+
+	if ((pid = fork()) == -1)
+		die("fork:");
+	if (pid == 0) {
+		if (setsid() == -1)
+			die("setsid:");
+		if ((slave = open(ptsname(*master), O_RDWR)) == -1)
+			die("open: %s:", ptsname(*master));
+#ifdef TIOCSCTTY
+		if (ioctl(slave, TIOCSCTTY, 0) == -1)
+			die("ioctl:");
+#endif
+		if (ioctl(slave, TIOCSWINSZ, &ws) == -1)
+			die("ioctl:");
+		if (dup2(slave, STDIN_FILENO) == -1 ||
+		    dup2(slave, STDOUT_FILENO) == -1 ||
+		    dup2(slave, STDERR_FILENO) == -1)
+			die("dup2:");
+		if (r->ucspi && (dup2(sv[1], 6) == -1 || dup2(sv[1], 7) == -1))
+			die("dup2:");
+		setenv("TERM", "xterm", 1);
+		unsetenv("EDITOR");
+		execv(lchat, argv);
+		die("execv: %s:", lchat);
+	}
+
+	*backend = -1;
+	if (r->ucspi) {
+		if (close(sv[1]) == -1)
+			die("close:");
+		*backend = sv[0];
+	} else if ((*backend = open("out", O_WRONLY|O_APPEND)) == -1) {
+		die("open: out:");
+	}
+	if (fcntl(*backend, F_SETFL, O_NONBLOCK) == -1 ||
+	    fcntl(*master, F_SETFL, O_NONBLOCK) == -1)
+		die("fcntl:");
+
+	return pid;
+}
+
+/* discard lchat's output, until it is quiet for ms */
+static void
+drain(int master, int ms)
+{
+	struct pollfd pfd = {.fd = master, .events = POLLIN};
+	char buf[BUFSIZ];
+
+	while (poll(&pfd, 1, ms) > 0)
+		if (read(master, buf, sizeof buf) <= 0)
+			break;
+}
+
+/* returns the read and write calls of pid, -1 without /proc */
+static long long
+syscalls(pid_t pid)
+{
+	char path[64], key[32];
+	long long val, sum = 0;
+	FILE *fp;
+
+	snprintf(path, sizeof path, "/proc/%ld/io", (long)pid);
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	while (fscanf(fp, "%31s %lld", key, &val) == 2)
+		if (strcmp(key, "syscr:") == 0 || strcmp(key, "syscw:") == 0)
+			sum += val;
+	fclose(fp);
+
+	return sum;
+}
+
+static int
+cmp(const void *a, const void *b)
+{
+	uint_least64_t x = *(const uint_least64_t *)a;
+	uint_least64_t y = *(const uint_least64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double
+percentile(int p)
+{
+	if (nlatency == 0)
+		return 0;
+
+	return latency[(nlatency - 1) * p / 100] / 1000.0;
+}
+
+static void
+bench(const struct run *r)
+{
+	char buf[BUFSIZ], out[BUFSIZ];
+	size_t sent = 0, shown = 0, off = 0, len = 0;
+	uint_least64_t start, last, probe = 0, next = 0;
+	long long calls;
+	struct rusage ru;
+	int master, backend, status;
+	pid_t pid;
+
+	clean();
+	put_file("in", "", 0600);
+	put_file("out", "", 0600);
+	if (r->bell)
+		put_file(".bellmatch", "<boss>\n", 0600);
+	if (r->filter)
+		put_file(".filter", "#!/bin/sh\nexec cat\n", 0700);
+
+	pid = spawn(r, &master, &backend);
+
+	/* skip the initial prompt and title */
+	drain(master, 300);
+
+	nlatency = 0;
+	start = last = now();
+	while (shown < nlines) {
+		struct pollfd pfd = {.fd = master, .events = POLLIN};
+		uint_least64_t t = now();
+		size_t due = nlines;
+		ssize_t n;
+
+		if (t - last > BENCH_WAIT)
+			die("lchat is stuck at line %zu of %zu", shown, nlines);
+		if (rate > 0 && (t - start) / 1000 * rate / 1000000 < nlines)
+			due = (t - start) / 1000 * rate / 1000000;
+
+		/* feed the backend, as far as it takes the lines */
+		while (off < len || sent < due) {
+			if (off == len) {
+				off = len = 0;
+				while (sent < due && len + 128 < sizeof out)
+					len += snprintf(out + len,
+					    sizeof out - len, "%lld <bench> "
+					    "line %zu of the synthetic flood\n",
+					    (long long)time(NULL), sent++);
+			}
+			if ((n = write(backend, out + off, len - off)) == -1) {
+				if (errno == EAGAIN)
+					break;
+				die("write:");
+			}
+			off += n;
+		}
+
+		/* type the next probe */
+		if (probe == 0 && t >= next) {
+			buf[0] = PROBE_KEY;
+			if (write(master, buf, 1) == -1)
+				die("write:");
+			probe = t;
+		}
+
+		if (poll(&pfd, 1, 1) == -1)
+			die("poll:");
+		if ((n = read(master, buf, sizeof buf)) == -1) {
+			if (errno == EAGAIN)
+				continue;
+			die("lchat exited");
+		}
+
+		last = now();
+		for (ssize_t i = 0; i < n; i++) {
+			shown += buf[i] == '\n';
+			if (probe == 0 || buf[i] != PROBE_KEY)
+				continue;
+			if (nlatency < PROBE_MAX)
+				latency[nlatency++] = last - probe;
+			probe = 0;
+			next = last + PROBE_GAP;
+			if (write(master, "\x7f", 1) == -1)
+				die("write:");
+		}
+	}
+	last = now();
+
+	calls = syscalls(pid);
+	if (kill(pid, SIGTERM) == -1)
+		die("kill:");
+	if (wait4(pid, &status, 0, &ru) == -1)
+		die("wait4:");
+	if (close(master) == -1 || close(backend) == -1)
+		die("close:");
+
+	qsort(latency, nlatency, sizeof *latency, cmp);
+	printf("%s\t%s\t%s\t%lu\t%.0f\t%.0f\t", r->ucspi ? "ucspi" : "tail",
+	    r->bell ? "yes" : "no", r->filter ? "yes" : "no", rate,
+	    shown / ((last - start) / 1e9),
+	    (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 +
+	    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3);
+	if (calls == -1)
+		printf("-");
+	else
+		printf("%.2f", (double)calls / shown);
+	printf("\t%.0f\t%.0f\n", percentile(50), percentile(99));
+	if (fflush(stdout) == EOF)
+		die("fflush:");
+}
+
+static void
+usage(void)
+{
+	fputs("lchat_bench [-n lines] [-r rate] [lchat]\n", stderr);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *path = "./lchat";
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:r:h")) != -1) {
+		switch (ch) {
+		case 'n':
+			errno = 0;
+			nlines = strtoull(optarg, NULL, 0);
+			if (errno != 0)
+				die("strtoull:");
+			if (nlines == 0)
+				usage();
+			break;
+		case 'r':
+			errno = 0;
+			rate = strtoul(optarg, NULL, 0);
+			if (errno != 0)
+				die("strtoul:");
+			break;
+		case 'h':
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc > 1)
+		usage();
+	if (argc == 1)
+		path = argv[0];
+
+	/* lchat runs inside of the scratch directory */
+	if ((lchat = realpath(path, NULL)) == NULL)
+		die("realpath: %s:", path);
+	if (mkdtemp(dir) == NULL)
+		die("mkdtemp:");
+	if (chdir(dir) == -1)
+		die("chdir: %s:", dir);
+	signal(SIGPIPE, SIG_IGN);
+
+	puts("# backend\tbell\tfilter\trate\tlines/s\tcpu_ms\tsyscalls/line"
+	    "\tp50_us\tp99_us");
+	for (int i = 0; i < 8; i++) {
+		struct run r = {
+			.ucspi = i & 4,
+			.bell = i & 2,
+			.filter = i & 1
+		};
+
+		bench(&r);
+	}
+
+	clean();
+	if (chdir("/") == -1 || rmdir(dir) == -1)
+		die("rmdir: %s:", dir);
+	free(lchat);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,298 @@
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <regex.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+
+/* an idle lchat must not use more cpu time than this in a second */
+#define IDLE_MS		100
+
+static char *lchat;
+static char dir[] = "/tmp/lchat_test.XXXXXX";
+
+/* terminal output of lchat since the last call of expect() */
+static char screen[BUFSIZ * 8];
+static size_t screen_len;
+
+static void
+put_file(const char *name, const char *content, mode_t mode)
+{
+	int fd;
+
+	if ((fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, mode)) == -1)
+		die("open: %s:", name);
+	if (write(fd, content, strlen(content)) == -1)
+		die("write: %s:", name);
+	if (close(fd) == -1)
+		die("close:");
+}
+
+static void
+append(const char *name, const char *line)
+{
+	int fd;
+
+	if ((fd = open(name, O_WRONLY|O_APPEND)) == -1)
+		die("open: %s:", name);
+	if (write(fd, line, strlen(line)) == -1)
+		die("write: %s:", name);
+	if (close(fd) == -1)
+		die("close:");
+}
+
+/* start lchat with argv on a new pseudo terminal and return its master */
+static pid_t
+spawn(char *argv[], int *master)
+{
+	struct winsize ws = {.ws_row = 24, .ws_col = 80};
+	int slave;
+	pid_t pid;
+
+	if ((*master = posix_openpt(O_RDWR|O_NOCTTY)) == -1)
+		die("posix_openpt:");
+	if (grantpt(*master) == -1 || unlockpt(*master) == -1)
+		die("grantpt:");
+	if (fcntl(*master, F_SETFD, FD_CLOEXEC) == -1)
+		die("fcntl:");
+
+	if ((pid = fork()) == -1)
+		die("fork:");
+	if (pid == 0) {
+		if (setsid() == -1)
+			die("setsid:");
+		if ((slave = open(ptsname(*master), O_RDWR)) == -1)
+			die("open: %s:", ptsname(*master));
+#ifdef TIOCSCTTY
+		if (ioctl(slave, TIOCSCTTY, 0) == -1)
+			die("ioctl:");
+#endif
+		if (ioctl(slave, TIOCSWINSZ, &ws) == -1)
+			die("ioctl:");
+		if (dup2(slave, STDIN_FILENO) == -1 ||
+		    dup2(slave, STDOUT_FILENO) == -1 ||
+		    dup2(slave, STDERR_FILENO) == -1)
+			die("dup2:");
+		if (slave > STDERR_FILENO && close(slave) == -1)
+			die("close:");
+		setenv("TERM", "xterm", 1);
+		unsetenv("EDITOR");
+		execv(lchat, argv);
+		die("execv: %s:", lchat);
+	}
+
+	screen_len = 0;
+	return pid;
+}
+
+/*
+ * Collect the output of lchat for ms or until it contains str.  Returns
+ * true, if str was found.  A NULL str just waits.
+ */
+static bool
+expect(int master, const char *str, int ms)
+{
+	struct pollfd pfd = {.fd = master, .events = POLLIN};
+	ssize_t n;
+
+	screen_len = 0;
+	while (poll(&pfd, 1, ms) > 0) {
+		if (screen_len == sizeof screen - 1)
+			screen_len = 0;
+		if ((n = read(master, screen + screen_len,
+		    sizeof screen - 1 - screen_len)) <= 0)
+			break;
+		screen_len += n;
+		screen[screen_len] = '\0';
+		if (str != NULL && strstr(screen, str) != NULL)
+			return true;
+	}
+
+	return false;
+}
+
+static void
+type(int master, const char *keys)
+{
+	if (write(master, keys, strlen(keys)) == -1)
+		die("write:");
+}
+
+/* stop lchat and return its cpu time in milliseconds */
+static long
+stop(pid_t pid, int master)
+{
+	struct rusage ru;
+	int status;
+
+	if (kill(pid, SIGTERM) == -1)
+		die("kill:");
+	if (wait4(pid, &status, 0, &ru) == -1)
+		die("wait4:");
+	if (close(master) == -1)
+		die("close:");
+
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000 +
+	    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000;
+}
+
+/* the loop goes idle, after the reader of the in FIFO went away */
+static void
+check_fifo_reader(void)
+{
+	char *argv[] = {"lchat", ".", NULL};
+	char buf[BUFSIZ];
+	int master, reader;
+	ssize_t n;
+	long ms;
+	pid_t pid;
+
+	put_file("out", "", 0600);
+	if (mkfifo("in", 0600) == -1)
+		die("mkfifo:");
+	if ((reader = open("in", O_RDONLY|O_NONBLOCK|O_CLOEXEC)) == -1)
+		die("open: in:");
+
+	pid = spawn(argv, &master);
+	expect(master, "> ", 1000);
+	type(master, "hello\r");
+	expect(master, NULL, 300);
+	n = read(reader, buf, sizeof buf);
+	assert(n == 6 && memcmp(buf, "hello\n", 6) == 0);
+
+	if (close(reader) == -1)
+		die("close:");
+	expect(master, NULL, 1000);
+
+	/* the next line goes to a new reader */
+	if ((reader = open("in", O_RDONLY|O_NONBLOCK|O_CLOEXEC)) == -1)
+		die("open: in:");
+	type(master, "again\r");
+	expect(master, NULL, 300);
+	n = read(reader, buf, sizeof buf);
+	assert(n == 6 && memcmp(buf, "again\n", 6) == 0);
+
+	ms = stop(pid, master);
+	assert(ms < IDLE_MS);
+	if (close(reader) == -1)
+		die("close:");
+
+	if (unlink("in") == -1 || unlink("out") == -1 ||
+	    unlink(".history") == -1)
+		die("unlink:");
+}
+
+/* lchat starts and sends lines without a usable .history */
+static void
+check_history_unusable(void)
+{
+	char *argv[] = {"lchat", ".", NULL};
+	char buf[BUFSIZ];
+	int master, fd;
+	ssize_t n;
+	pid_t pid;
+
+	put_file("in", "", 0600);
+	put_file("out", "", 0600);
+	if (mkdir(".history", 0700) == -1)
+		die("mkdir:");
+
+	pid = spawn(argv, &master);
+	assert(expect(master, "history is not saved", 1000));
+	expect(master, "> ", 1000);
+	type(master, "hello\r");
+	expect(master, NULL, 300);
+	stop(pid, master);
+
+	if ((fd = open("in", O_RDONLY)) == -1)
+		die("open: in:");
+	n = read(fd, buf, sizeof buf);
+	assert(n == 6 && memcmp(buf, "hello\n", 6) == 0);
+	if (close(fd) == -1)
+		die("close:");
+
+	if (unlink("in") == -1 || unlink("out") == -1 ||
+	    rmdir(".history") == -1)
+		die("unlink:");
+}
+
+/* output of the .filter stays with its directory, even after a switch */
+static void
+check_filter_switch(void)
+{
+	char *argv[] = {"lchat", "-a", "a", "b", NULL};
+	const char *files[] = {"a/in", "a/out", "a/.history",
+	    "b/in", "b/out", "b/.history", ".filter"};
+	int master;
+	pid_t pid;
+
+	if (mkdir("a", 0700) == -1 || mkdir("b", 0700) == -1)
+		die("mkdir:");
+	put_file("a/in", "", 0600);
+	put_file("a/out", "", 0600);
+	put_file("b/in", "", 0600);
+	put_file("b/out", "", 0600);
+	put_file(".filter", "#!/bin/sh\n"
+	    "while read l; do sleep 0.3; echo \"F:$l\"; done\n", 0700);
+
+	pid = spawn(argv, &master);
+	assert(expect(master, "a > ", 1000));
+
+	/* switch, while the .filter of a is still busy with the line */
+	append("a/out", "alpha\n");
+	expect(master, NULL, 100);
+	type(master, "\x0f");
+	assert(!expect(master, "F:alpha", 800));
+	assert(strstr(screen, "b > ") != NULL);
+
+	type(master, "\x0f");
+	assert(expect(master, "F:alpha", 1000));
+
+	stop(pid, master);
+	for (size_t i = 0; i < sizeof files / sizeof *files; i++)
+		if (unlink(files[i]) == -1)
+			die("unlink: %s:", files[i]);
+	if (rmdir("a") == -1 || rmdir("b") == -1)
+		die("rmdir:");
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *path = argc > 1 ? argv[1] : "./lchat";
+
+	/* lchat runs inside of the scratch directory */
+	if ((lchat = realpath(path, NULL)) == NULL)
+		die("realpath: %s:", path);
+	if (mkdtemp(dir) == NULL)
+		die("mkdtemp:");
+	if (chdir(dir) == -1)
+		die("chdir: %s:", dir);
+	signal(SIGPIPE, SIG_IGN);
+
+	check_fifo_reader();
+	check_history_unusable();
+	check_filter_switch();
+
+	if (chdir("/") == -1 || rmdir(dir) == -1)
+		die("rmdir: %s:", dir);
+	free(lchat);
+
+	return EXIT_SUCCESS;
+}
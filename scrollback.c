@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2023 Jan Klemkow <j.klemkow@wemelug.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <regex.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+#include "scrollback.h"
+
+/*
+ * The lines live in SB_CHUNKS chunks of SB_CHUNKSIZE bytes.  A line, which
+ * does not fit into the rest of a chunk, moves on to the next one.  This
+ * chunk loses all of its old lines, which are the oldest of the ring.
+ */
+#define SB_CHUNKSIZE	(64 * 1024)
+#define SB_CHUNKS	16
+#define SB_LINES	16384
+
+#define LINE(sb, i)	(&(sb)->line[((sb)->first + (i)) % SB_LINES])
+
+static void
+scrollback_init(struct scrollback *sb)
+{
+	if ((sb->chunk = calloc(SB_CHUNKS, sizeof *sb->chunk)) == NULL)
+		die("calloc:");
+	if ((sb->chunk[0] = malloc(SB_CHUNKSIZE)) == NULL)
+		die("malloc:");
+	if ((sb->line = malloc(SB_LINES * sizeof *sb->line)) == NULL)
+		die("malloc:");
+	sb->cchunk = 0;
+	sb->used = 0;
+	sb->first = 0;
+	sb->count = 0;
+	sb->open = false;
+}
+
+static void
+scrollback_drop(struct scrollback *sb)
+{
+	sb->first = (sb->first + 1) % SB_LINES;
+	sb->count--;
+	if (sb->view > sb->count)
+		sb->view = sb->count;
+}
+
+/* move the open line e into the next chunk */
+static void
+scrollback_next(struct scrollback *sb, struct sb_line *e)
+{
+	sb->cchunk = (sb->cchunk + 1) % SB_CHUNKS;
+	if (sb->chunk[sb->cchunk] == NULL &&
+	    (sb->chunk[sb->cchunk] = malloc(SB_CHUNKSIZE)) == NULL)
+		die("malloc:");
+
+	while (sb->count > 1 && LINE(sb, 0)->chunk == sb->cchunk)
+		scrollback_drop(sb);
+
+	memcpy(sb->chunk[sb->cchunk], sb->chunk[e->chunk] + e->off, e->len);
+	e->chunk = sb->cchunk;
+	e->off = 0;
+	sb->used = e->len;
+}
+
+/* append len bytes to the open line or a new one */
+static void
+scrollback_append(struct scrollback *sb, const char *data, size_t len)
+{
+	struct sb_line *e;
+
+	if (!sb->open) {
+		if (sb->count == SB_LINES)
+			scrollback_drop(sb);
+		e = LINE(sb, sb->count++);
+		e->chunk = sb->cchunk;
+		e->off = sb->used;
+		e->len = 0;
+		sb->open = true;
+
+		/* keep the view on the same lines */
+		if (sb->view > 0)
+			sb->view++;
+	}
+	e = LINE(sb, sb->count - 1);
+
+	/* cut lines, which are longer than a chunk */
+	if (len > SB_CHUNKSIZE - e->len)
+		len = SB_CHUNKSIZE - e->len;
+	if (sb->used + len > SB_CHUNKSIZE)
+		scrollback_next(sb, e);
+
+	memcpy(sb->chunk[e->chunk] + e->off + e->len, data, len);
+	e->len += len;
+	sb->used += len;
+}
+
+/* add len bytes of output, lines are split at their newline */
+void
+scrollback_add(struct scrollback *sb, const char *data, size_t len)
+{
+	if (sb->chunk == NULL)
+		scrollback_init(sb);
+
+	while (len > 0) {
+		const char *nl = memchr(data, '\n', len);
+		size_t n = nl != NULL ? (size_t)(nl - data) : len;
+
+		scrollback_append(sb, data, n);
+		if (nl != NULL) {
+			sb->open = false;
+			n++;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+/* returns line i, counted from the oldest one */
+const char *
+scrollback_line(struct scrollback *sb, size_t i, size_t *len)
+{
+	struct sb_line *e = LINE(sb, i);
+
+	*len = e->len;
+	return sb->chunk[e->chunk] + e->off;
+}
+
+void
+scrollback_free(struct scrollback *sb)
+{
+	if (sb->chunk != NULL)
+		for (size_t i = 0; i < SB_CHUNKS; i++)
+			free(sb->chunk[i]);
+	free(sb->chunk);
+	free(sb->line);
+	sb->chunk = NULL;
+	sb->line = NULL;
+}
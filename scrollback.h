@@ -0,0 +1,29 @@
+#ifndef SCROLLBACK_H
+#define SCROLLBACK_H
+
+/* a line of the scrollback in one of its chunks */
+struct sb_line {
+	size_t chunk;
+	size_t off;
+	size_t len;	/* without newline */
+};
+
+/* the newest output lines of the terminal */
+struct scrollback {
+	char **chunk;		/* arena, filled chunk by chunk like a ring */
+	size_t cchunk;		/* chunk, which gets filled */
+	size_t used;		/* bytes used in it */
+
+	struct sb_line *line;	/* ring of lines */
+	size_t first;		/* oldest line */
+	size_t count;		/* amount of lines */
+	bool open;		/* the newest line has no newline yet */
+
+	size_t view;		/* amount of lines scrolled back */
+};
+
+void scrollback_add(struct scrollback *sb, const char *data, size_t len);
+const char *scrollback_line(struct scrollback *sb, size_t i, size_t *len);
+void scrollback_free(struct scrollback *sb);
+
+#endif
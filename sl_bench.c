@@ -0,0 +1,202 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "slackline.h"
+#include "slackline_internals.h"
+
+/*
+ * Measure every operation for at least BENCH_NSEC, unless the preparation
+ * of the lines takes up BENCH_WALL.
+ */
+#define BENCH_NSEC	(20 * 1000 * 1000)
+#define BENCH_WALL	(100 * 1000 * 1000)
+
+/* most operations between two clock readings */
+#define BENCH_BATCH	1000
+
+static const size_t lengths[] = {10, 100, 1000, 10000, 100000};
+
+/* the lines consist of words of four graphemes of these kinds */
+static const struct {
+	const char *name;
+	const char *grapheme;
+} inputs[] = {
+	{"ascii",	"a"},
+	{"combining",	"e\xCC\x81"},			/* e, U+0301 */
+	{"emoji",	"\xF0\x9F\x91\x8D\xF0\x9F\x8F\xBD"},	/* U+1F44D, U+1F3FD */
+};
+
+static void
+fail(const char *op)
+{
+	fprintf(stderr, "sl_bench: %s failed\n", op);
+	exit(EXIT_FAILURE);
+}
+
+static void
+keys(struct slackline *sl, const char *str)
+{
+	for (const char *c = str; *c != '\0'; c++)
+		if (sl_keystroke(sl, (unsigned char)*c) == -1)
+			fail("sl_keystroke");
+}
+
+/* type one grapheme byte by byte */
+static void
+op_type(struct slackline *sl, const char *g, size_t i)
+{
+	(void)i;
+	keys(sl, g);
+}
+
+static void
+op_backspace(struct slackline *sl, const char *g, size_t i)
+{
+	(void)g;
+	(void)i;
+	sl_backspace(sl);
+}
+
+static void
+op_ctrl_w(struct slackline *sl, const char *g, size_t i)
+{
+	(void)g;
+	(void)i;
+	keys(sl, "\x17");
+}
+
+static void
+op_ctrl_k(struct slackline *sl, const char *g, size_t i)
+{
+	(void)g;
+	(void)i;
+	keys(sl, "\x0b");
+}
+
+static void
+op_move(struct slackline *sl, const char *g, size_t i)
+{
+	(void)g;
+	(void)i;
+	sl_move(sl, LEFT);
+}
+
+static volatile size_t sink;
+
+static void
+op_postobyte(struct slackline *sl, const char *g, size_t i)
+{
+	(void)g;
+	sink = sl_postobyte(sl, i * 7919 % (sl->rlen + 1));
+}
+
+/*
+ * cost is the amount of graphemes an operation removes, 0 if it adds one
+ * and SIZE_MAX if the line takes just one operation.
+ */
+static const struct {
+	const char *name;
+	void (*op)(struct slackline *sl, const char *g, size_t i);
+	bool middle;		/* start at the middle instead of the end */
+	size_t cost;
+} ops[] = {
+	{"append",	op_type,	false,	0},
+	{"insert",	op_type,	true,	0},
+	{"backspace",	op_backspace,	false,	1},
+	{"ctrl_w",	op_ctrl_w,	false,	5},
+	{"ctrl_k",	op_ctrl_k,	true,	SIZE_MAX},
+	{"move",	op_move,	false,	1},
+	{"postobyte",	op_postobyte,	false,	0},
+};
+
+static uint_least64_t
+now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		fail("clock_gettime");
+
+	return (uint_least64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* returns ns per operation o on lines of n graphemes */
+static double
+bench(struct slackline *sl, size_t o, const char *g, const char *line,
+    size_t len, size_t n)
+{
+	uint_least64_t total = 0, count = 0, begin = now();
+	size_t batch = ops[o].cost == 0 ? n : n / ops[o].cost;
+
+	if (batch > BENCH_BATCH)
+		batch = BENCH_BATCH;
+	if (batch == 0)
+		batch = 1;
+
+	while (total < BENCH_NSEC && (count == 0 ||
+	    now() - begin < BENCH_WALL)) {
+		uint_least64_t start;
+
+		if (sl_set(sl, line, len) == -1)
+			fail("sl_set");
+		for (size_t i = 0; ops[o].middle && i < n - n / 2; i++)
+			sl_move(sl, LEFT);
+
+		start = now();
+		for (size_t i = 0; i < batch; i++)
+			ops[o].op(sl, g, i);
+		total += now() - start;
+		count += batch;
+	}
+
+	return (double)total / count;
+}
+
+int
+main(void)
+{
+	struct slackline *sl;
+	size_t max = lengths[sizeof lengths / sizeof *lengths - 1];
+
+	if ((sl = sl_init()) == NULL)
+		fail("sl_init");
+	sl_mode(sl, SL_EMACS);
+
+	puts("# operation\tinput\tgraphemes\tns/op");
+	for (size_t k = 0; k < sizeof inputs / sizeof *inputs; k++) {
+		const char *g = inputs[k].grapheme;
+		size_t glen = strlen(g);
+		char *line;
+
+		if ((line = malloc(max * glen)) == NULL)
+			fail("malloc");
+
+		for (size_t l = 0; l < sizeof lengths / sizeof *lengths; l++) {
+			size_t n = lengths[l], len = 0;
+
+			for (size_t i = 0; i < n; i++) {
+				if (i % 5 == 4) {
+					line[len++] = ' ';
+				} else {
+					memcpy(line + len, g, glen);
+					len += glen;
+				}
+			}
+
+			for (size_t o = 0; o < sizeof ops / sizeof *ops; o++)
+				printf("%s\t%s\t%zu\t%.1f\n", ops[o].name,
+				    inputs[k].name, n,
+				    bench(sl, o, g, line, len, n));
+			if (fflush(stdout) == EOF)
+				fail("fflush");
+		}
+		free(line);
+	}
+	sl_free(sl);
+
+	return EXIT_SUCCESS;
+}
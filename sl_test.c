@@ -1,9 +1,14 @@
 #include <assert.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "slackline.h"
+#include "slackline_internals.h"
+
+/* several hundred bytes, so the history arena wraps before its cap */
+#define HIST_LINE	500
 
 static void
 strokes(struct slackline *sl, const char *str)
@@ -90,6 +95,358 @@ check_utf8(struct slackline *sl)
 	assert(sl->last - sl->buf == sl->blen);
 }
 
+static void
+check_grapheme(struct slackline *sl)
+{
+	/* e + combining acute accent is one rune */
+	strokes(sl, "xe\xCC\x81y");
+	assert(sl->blen == 5);
+	assert(sl->rlen == 3);
+	assert(sl->rcur == 3);
+	assert(sl_postobyte(sl, 1) == 1);
+	assert(sl_postobyte(sl, 2) == 4);
+
+	strokes(sl, "\x1b[D\x08");	/* left arrow key, backspace */
+	assert(strcmp(sl_buf(sl), "xy") == 0);
+	assert(sl->rlen == 2);
+	assert(sl->rcur == 1);
+	assert(sl->bcur == 1);
+
+	sl_mode(sl, SL_EMACS);
+	strokes(sl, "\xC3\xA4\x14");	/* ae, ctrl+t */
+	assert(strcmp(sl_buf(sl), "\xC3\xA4xy") == 0);
+	assert(sl->rcur == 2);
+	assert(sl->bcur == 3);
+	sl_mode(sl, SL_DEFAULT);
+}
+
+static void
+check_kill(struct slackline *sl)
+{
+	strokes(sl, "foo b\xC3\xA4r  baz");
+	assert(sl->rlen == 12);
+
+	strokes(sl, "\x17");	/* ctrl+w */
+	assert(strcmp(sl_buf(sl), "foo b\xC3\xA4r  ") == 0);
+	assert(sl->rcur == 9);
+
+	strokes(sl, "\x17");	/* ctrl+w */
+	assert(strcmp(sl_buf(sl), "foo ") == 0);
+	assert(sl->rcur == 4);
+	assert(sl->bcur == 4);
+
+	sl_mode(sl, SL_EMACS);
+	strokes(sl, "bar\x01\x06\x0b");	/* ctrl+a, ctrl+f, ctrl+k */
+	assert(strcmp(sl_buf(sl), "f") == 0);
+	assert(sl->rlen == 1);
+	assert(sl->rcur == 1);
+	assert(sl->last - sl->buf == sl->blen);
+
+	strokes(sl, "\x15");	/* ctrl+u */
+	assert(sl->blen == 0);
+	assert(sl->rcur == 0);
+	sl_mode(sl, SL_DEFAULT);
+}
+
+static void
+check_input(struct slackline *sl)
+{
+	const char *str = "ab\xC3\xA4\x1b[Dc";
+	size_t n;
+
+	assert(sl_input(sl, str, strlen(str)) == 0);
+	assert(strcmp(sl_buf(sl), "abc\xC3\xA4") == 0);
+	assert(sl->blen == 5);
+	assert(sl->rlen == 4);
+	assert(sl->bcur == 3);
+	assert(sl->rcur == 3);
+	assert(sl->last - sl->buf == sl->blen);
+
+	/* bracketed paste inserts control characters literally */
+	str = "\x1b[200~\t\x17\x1b[D\x1b[201~\x1b[D";
+	assert(sl_input(sl, str, strlen(str)) == 0);
+	assert(strcmp(sl_buf(sl), "abc\t\x17\xC3\xA4") == 0);
+	assert(sl->paste == false);
+	assert(sl->rcur == 4);
+	assert(sl->rlen == 6);
+
+	/* the paste goes on after the return key, which lchat handles */
+	sl_reset(sl);
+	str = "\x1b[200~a\rb\x01" "c\x1b[201~";
+	n = strcspn(str, "\r");
+	assert(sl_input(sl, str, n) == 0);
+	sl_reset(sl);
+	assert(sl_input(sl, str + n + 1, strlen(str + n + 1)) == 0);
+	assert(strcmp(sl_buf(sl), "b\x01" "c") == 0);
+	assert(sl->paste == false);
+	assert(sl->rlen == 3);
+}
+
+static void
+check_gap(struct slackline *sl)
+{
+	char buf[16];
+
+	/* edit in the middle, so the gap sits between the runes */
+	strokes(sl, "acd\x1b[D\x1b[Db");
+	assert(sl->gap == 2);
+	sl_copy(sl, buf);
+	assert(strcmp(buf, "abcd") == 0);
+
+	/* the combining mark behind the gap joins the new rune */
+	strokes(sl, "\x15\xCC\x81xy\x1b[H\x1b[C\x1b[C");
+	assert(sl->rlen == 3);
+	strokes(sl, "\x1b[D\x1b[De");
+	assert(sl->gap == 1);
+	assert(sl->rlen == 3);
+	assert(sl->rcur == 1);
+	assert(sl->bcur == 3);
+
+	strokes(sl, "\x1b[3~");	/* delete */
+	assert(strcmp(sl_buf(sl), "e\xCC\x81y") == 0);
+	assert(sl->gap == sl->blen);
+	assert(sl->rlen == 2);
+	assert(sl->rcur == 1);
+}
+
+static void
+check_run(struct slackline *sl)
+{
+	const char *run = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+	/* a combining mark joins the last character of an ASCII run */
+	assert(sl_input(sl, run, strlen(run)) == 0);
+	strokes(sl, "\xCC\x81");
+	assert(sl->rlen == 36);
+	assert(sl->blen == 38);
+	assert(sl_postobyte(sl, 35) == 35);
+
+	/* in front of the gap, inside of a run */
+	for (int i = 0; i < 20; i++)
+		strokes(sl, "\x1b[D");
+	strokes(sl, "\xCC\x81");
+	assert(sl->rlen == 36);
+	assert(sl->rcur == 16);
+	assert(sl_postobyte(sl, 16) - sl_postobyte(sl, 15) == 3);
+
+	assert(sl_input(sl, run, strlen(run)) == 0);
+	assert(sl->rlen == 72);
+	assert(sl->rcur == 52);
+	for (size_t i = 16; i < 52; i++)
+		assert(sl_postobyte(sl, i) == i + 2);
+	assert(sl_postobyte(sl, 72) == sl->blen);
+	sl_buf(sl);
+	assert(memcmp(sl->buf + 18, run, 36) == 0);
+}
+
+/* edits in the middle of a long line leave the index behind them alone */
+static void
+check_index(struct slackline *sl)
+{
+	size_t n = 10000, tail, *copy;
+
+	for (size_t i = 0; i < n; i++)
+		strokes(sl, i % 5 == 4 ? " " : "e\xCC\x81");
+	for (size_t i = 0; i < n / 2; i++)
+		strokes(sl, "\x1b[D");
+	strokes(sl, "x");
+	assert(sl->ggap == sl->rcur);
+
+	tail = sl->rlen + 1 - sl->ggap;
+	assert((copy = malloc(tail * sizeof *copy)) != NULL);
+	memcpy(copy, sl->gidx + sl->gsize - tail, tail * sizeof *copy);
+
+	strokes(sl, "yz\x08");
+	assert(sl->rlen == n + 2);
+	assert(sl->rcur == n / 2 + 2);
+	assert(sl_postobyte(sl, sl->rlen) == sl->blen);
+	assert(memcmp(copy, sl->gidx + sl->gsize - tail,
+	    tail * sizeof *copy) == 0);
+	free(copy);
+
+	sl_buf(sl);
+	assert(memcmp(sl_postoptr(sl, sl->rcur - 2), "xye\xCC\x81", 5) == 0);
+}
+
+static void
+check_vi(struct slackline *sl)
+{
+	sl_mode(sl, SL_VI);
+
+	/* arrow keys stay in the insert mode */
+	strokes(sl, "one two three four\x1b[D\x1b[Cx");
+	assert(strcmp(sl_buf(sl), "one two three fourx") == 0);
+	assert(sl->vi.insert);
+
+	strokes(sl, "\x1b" "x0dw");
+	assert(strcmp(sl_buf(sl), "two three four") == 0);
+	assert(!sl->vi.insert);
+	assert(sl->rcur == 0);
+
+	/* counts of the operator and the motion multiply */
+	strokes(sl, "2d1w");
+	assert(strcmp(sl_buf(sl), "four") == 0);
+
+	strokes(sl, "Aty\x1b" "0cwfive\x1b" "b");
+	assert(strcmp(sl_buf(sl), "five") == 0);
+	assert(sl->rcur == 0);
+
+	strokes(sl, "A six seven\x1b" "2bc$eight\x1b" "^3x");
+	assert(strcmp(sl_buf(sl), "e eight") == 0);
+
+	strokes(sl, "dd");
+	assert(sl->rlen == 0);
+	assert(!sl->vi.insert);
+
+	/* ESC steps back onto the last rune at once */
+	strokes(sl, "iabc\x1b");
+	assert(!sl->vi.insert);
+	assert(sl->rcur == 2);
+	strokes(sl, "x");
+	assert(strcmp(sl_buf(sl), "ab") == 0);
+	assert(sl->rcur == 1);
+	strokes(sl, "x");
+	assert(strcmp(sl_buf(sl), "a") == 0);
+	assert(sl->rcur == 0);
+
+	/* an arrow key moves just once and stays in the insert mode */
+	strokes(sl, "A\x1b[D\x1b[Dx");
+	assert(strcmp(sl_buf(sl), "xa") == 0);
+	assert(sl->vi.insert);
+	strokes(sl, "\x1b");
+
+	sl_mode(sl, SL_DEFAULT);
+}
+
+/* line i of the history test, its number comes first */
+static void
+history_line(char *line, size_t i)
+{
+	for (size_t j = 0; j < HIST_LINE; j++)
+		line[j] = 'a' + (i + j) % 26;
+	for (size_t j = 6; j-- > 0; i /= 10)
+		line[j] = '0' + i % 10;
+}
+
+static void
+check_history(struct slackline *sl)
+{
+	char line[HIST_LINE];
+	struct sl_entry *e;
+	size_t wrap;
+
+	assert(sl_history_add(sl, "foo", 3) == 0);
+	assert(sl_history_add(sl, "b\xC3\xA4r", 4) == 0);
+	assert(sl_history_add(sl, "b\xC3\xA4r", 4) == 0);
+	assert(sl_history_add(sl, "", 0) == 0);
+	assert(sl->hist.count == 2);
+
+	strokes(sl, "new\x1b[A");	/* up arrow key */
+	assert(strcmp(sl_buf(sl), "b\xC3\xA4r") == 0);
+	assert(sl->rcur == 3);
+
+	strokes(sl, "\x1b[A\x1b[A");
+	assert(strcmp(sl_buf(sl), "foo") == 0);
+
+	strokes(sl, "\x1b[B\x1b[B\x1b[B");	/* down arrow key */
+	assert(strcmp(sl_buf(sl), "new") == 0);
+	assert(sl->rlen == 3);
+
+	/* the arena drops the oldest entries, when it wraps around */
+	wrap = (sl->hist.size - sl->hist.head) / HIST_LINE;
+	for (size_t i = 0; i < wrap + 2; i++) {
+		history_line(line, i);
+		assert(sl_history_add(sl, line, HIST_LINE) == 0);
+	}
+	assert(sl->hist.count == wrap);
+	assert(sl->hist.head == 2 * HIST_LINE);
+
+	e = &sl->hist.ent[sl->hist.first];
+	history_line(line, 2);
+	assert(e->len == HIST_LINE);
+	assert(memcmp(sl->hist.data + e->off, line, HIST_LINE) == 0);
+
+	/* recall the newest entry, which was written at the wrap */
+	sl_mode(sl, SL_EMACS);
+	strokes(sl, "\x10");	/* ctrl+p */
+	assert(sl->hist.pos == sl->hist.count - 1);
+	history_line(line, wrap + 1);
+	assert(sl->blen == HIST_LINE);
+	assert(memcmp(sl_buf(sl), line, HIST_LINE) == 0);
+
+	/* and the oldest one in front of it */
+	for (size_t i = 1; i < sl->hist.count; i++)
+		strokes(sl, "\x10");
+	assert(sl->hist.pos == 0);
+	history_line(line, 2);
+	assert(sl->blen == HIST_LINE);
+	assert(memcmp(sl_buf(sl), line, HIST_LINE) == 0);
+
+	for (size_t i = 0; i < sl->hist.count; i++)
+		strokes(sl, "\x0e");	/* ctrl+n */
+	assert(strcmp(sl_buf(sl), "new") == 0);
+	sl_mode(sl, SL_DEFAULT);
+}
+
+static void
+check_search(struct slackline *sl)
+{
+	assert(sl_history_add(sl, "make test", 9) == 0);
+	assert(sl_history_add(sl, "git commit", 10) == 0);
+	assert(sl_history_add(sl, "make clean", 10) == 0);
+	assert(sl_history_add(sl, "ls", 2) == 0);
+
+	sl_mode(sl, SL_EMACS);
+	strokes(sl, "x\x12ma");	/* ctrl+r */
+	assert(sl->hist.search);
+	assert(strcmp(sl_buf(sl), "make clean") == 0);
+
+	strokes(sl, "ke t");	/* the trigram index */
+	assert(strcmp(sl_buf(sl), "make test") == 0);
+	assert(!sl->hist.failed);
+
+	strokes(sl, "x");
+	assert(sl->hist.failed);
+	assert(strcmp(sl_buf(sl), "make test") == 0);
+
+	strokes(sl, "\x7f\x7f\x7f\x12");	/* backspace, ctrl+r */
+	assert(strcmp(sl_buf(sl), "make test") == 0);
+	assert(!sl->hist.failed);
+
+	strokes(sl, "\x07");	/* ctrl+g */
+	assert(!sl->hist.search);
+	assert(strcmp(sl_buf(sl), "x") == 0);
+
+	strokes(sl, "\x12" "com\x05!");	/* ctrl+e ends the search */
+	assert(!sl->hist.search);
+	assert(strcmp(sl_buf(sl), "git commit!") == 0);
+	sl_mode(sl, SL_DEFAULT);
+}
+
+static void
+check_source(struct slackline *sl)
+{
+	const char *src = "one\n\ntwo\none\n";
+
+	sl_history_source(sl, src, strlen(src));
+	assert(sl->hist.data == NULL);
+
+	strokes(sl, "\x1b[A");	/* up arrow key */
+	assert(sl->hist.count == 3);
+	assert(strcmp(sl_buf(sl), "one") == 0);
+	strokes(sl, "\x1b[A\x1b[A");
+	assert(strcmp(sl_buf(sl), "one") == 0);
+	assert(sl->hist.pos == 0);
+}
+
+static void
+check_page(struct slackline *sl)
+{
+	strokes(sl, "ab\x1b[5~\x1b[5~\x1b[6~c");
+	assert(sl->page == -1);
+	assert(strcmp(sl_buf(sl), "abc") == 0);
+}
+
 int
 main(void)
 {
@@ -103,6 +460,52 @@ main(void)
 	check_init(sl);
 	check_utf8(sl);
 
+	sl_reset(sl);
+	check_init(sl);
+	check_grapheme(sl);
+
+	sl_reset(sl);
+	check_init(sl);
+	check_kill(sl);
+
+	sl_reset(sl);
+	check_init(sl);
+	check_input(sl);
+
+	sl_reset(sl);
+	check_init(sl);
+	check_gap(sl);
+
+	sl_reset(sl);
+	check_init(sl);
+	check_run(sl);
+
+	sl_reset(sl);
+	check_init(sl);
+	check_index(sl);
+
+	sl_reset(sl);
+	check_init(sl);
+	check_vi(sl);
+
+	sl_reset(sl);
+	check_init(sl);
+	check_history(sl);
+
+	sl_free(sl);
+	sl = sl_init();
+	check_init(sl);
+	check_search(sl);
+
+	sl_free(sl);
+	sl = sl_init();
+	check_init(sl);
+	check_source(sl);
+
+	sl_reset(sl);
+	check_init(sl);
+	check_page(sl);
+
 	sl_free(sl);
 
 	return EXIT_SUCCESS;
@@ -16,19 +16,32 @@
  */
 
 #include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <grapheme.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "slackline_internals.h"
 #include "slackline.h"
-#include "util.h"
 
 /* CTRL+W: stop erasing if certain characters are reached. */
 #define IS_WORD_BREAK "\f\n\r\t\v (){}[]\\/#,.=-+|%$!@^&*"
 
+/* size of the gap, there is always room for a NUL byte */
+#define GAPLEN(sl) ((sl)->bufsize - (sl)->blen)
+
+/* the same for the grapheme index, with the entry of rlen */
+#define GIDX_GAPLEN(sl) ((sl)->gsize - (sl)->rlen - 1)
+
 struct slackline *
 sl_init(void)
 {
@@ -44,9 +57,18 @@ sl_init(void)
 		return NULL;
 	}
 
+	sl->gsize = 64;
+	if ((sl->gidx = malloc(sl->gsize * sizeof *sl->gidx)) == NULL) {
+		free(sl->buf);
+		free(sl);
+		return NULL;
+	}
+
 	memset(sl->ubuf, 0, sizeof(sl->ubuf));
 	sl->ubuf_len = 0;
+	memset(&sl->hist, 0, sizeof(sl->hist));
 
+	sl->paste = false;
 	sl_reset(sl);
 
 	sl->mode = SL_DEFAULT;
@@ -64,6 +86,8 @@ void
 sl_free(struct slackline *sl)
 {
 	free(sl->buf);
+	free(sl->gidx);
+	sl_history_free(&sl->hist);
 	free(sl);
 }
 
@@ -73,14 +97,27 @@ sl_reset(struct slackline *sl)
 	sl->buf[0] = '\0';
 	sl->ptr = sl->buf;
 	sl->last = sl->buf;
+	sl->gap = 0;
 
 	sl->bcur = 0;
 	sl->blen = 0;
 	sl->rcur = 0;
 	sl->rlen = 0;
+	sl->gidx[0] = 0;
+	sl->ggap = 1;
+	sl->gblen = 0;
 
+	/* a bracketed paste spans several lines */
 	sl->esc = ESC_NONE;
+	sl->page = 0;
 	sl->ubuf_len = 0;
+
+	sl->hist.pos = sl->hist.count;
+	sl->hist.search = false;
+
+	/* a new line starts in the vi insert mode */
+	memset(&sl->vi, 0, sizeof sl->vi);
+	sl->vi.insert = true;
 }
 
 void
@@ -89,17 +126,264 @@ sl_mode(struct slackline *sl, enum mode mode)
 	sl->mode = mode;
 }
 
+/* returns the address of the byte at position pos */
+char *
+sl_at(struct slackline *sl, size_t pos)
+{
+	return pos < sl->gap ? sl->buf + pos : sl->buf + pos + GAPLEN(sl);
+}
+
+/* move the gap to byte position pos */
+static void
+sl_gap(struct slackline *sl, size_t pos)
+{
+	if (pos < sl->gap)
+		memmove(sl->buf + pos + GAPLEN(sl), sl->buf + pos,
+		    sl->gap - pos);
+	else if (pos > sl->gap)
+		memmove(sl->buf + sl->gap, sl->buf + sl->gap + GAPLEN(sl),
+		    pos - sl->gap);
+	sl->gap = pos;
+
+	if (sl->gap == sl->blen)
+		sl->buf[sl->blen] = '\0';
+}
+
+/* returns the line as one NUL terminated string */
+char *
+sl_buf(struct slackline *sl)
+{
+	sl_gap(sl, sl->blen);
+	return sl->buf;
+}
+
+/* copy the line as NUL terminated string into dst of blen + 1 bytes */
+void
+sl_copy(struct slackline *sl, char *dst)
+{
+	memcpy(dst, sl->buf, sl->gap);
+	memcpy(dst + sl->gap, sl->buf + sl->gap + GAPLEN(sl),
+	    sl->blen - sl->gap);
+	dst[sl->blen] = '\0';
+}
+
+/* returns the length of the run of printable ASCII bytes at str */
+static size_t
+sl_ascii(const char *str, size_t len)
+{
+	size_t i = 0;
+
+	/* test 16 bytes at once, the rest of the run is found below */
+#if defined(__SSE2__)
+	const __m128i lo = _mm_set1_epi8(' ' - 1), hi = _mm_set1_epi8('~' + 1);
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(str + i));
+
+		/* bytes above 0x7f are negative */
+		if (_mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(v, lo),
+		    _mm_cmplt_epi8(v, hi))) != 0xffff)
+			break;
+	}
+#elif defined(__ARM_NEON)
+	const uint8x16_t lo = vdupq_n_u8(' '), hi = vdupq_n_u8('~');
+
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t v = vld1q_u8((const uint8_t *)str + i);
+		uint64x2_t ok = vreinterpretq_u64_u8(vandq_u8(vcgeq_u8(v, lo),
+		    vcleq_u8(v, hi)));
+
+		if ((vgetq_lane_u64(ok, 0) & vgetq_lane_u64(ok, 1)) !=
+		    UINT64_MAX)
+			break;
+	}
+#endif
+	while (i < len && str[i] >= ' ' && str[i] <= '~')
+		i++;
+
+	return i;
+}
+
+/*
+ * Returns the amount of graphemes of a single byte at byte position pos.
+ * A printable ASCII character is one, unless a non-ASCII rune follows.
+ */
+static size_t
+sl_ascii_graphemes(struct slackline *sl, size_t pos)
+{
+	size_t end = pos < sl->gap ? sl->gap : sl->blen;
+	size_t n = sl_ascii(sl_at(sl, pos), end - pos);
+
+	if (n > 0 && pos + n < sl->blen &&
+	    (unsigned char)*sl_at(sl, pos + n) >= 0x80)
+		n--;
+
+	return n;
+}
+
+/* returns the length of the grapheme at byte position pos */
+static size_t
+sl_next_break(struct slackline *sl, size_t pos)
+{
+	uint_least32_t cp0, cp1;
+	uint_least16_t state = 0;
+	size_t len;
+
+	if (pos >= sl->gap)
+		return grapheme_next_character_break_utf8(sl_at(sl, pos),
+		    sl->blen - pos);
+
+	len = grapheme_next_character_break_utf8(sl->buf + pos,
+	    sl->gap - pos);
+	if (pos + len < sl->gap || sl->gap == sl->blen)
+		return len;
+
+	/* the grapheme reaches the gap, segment it across the gap again */
+	len = grapheme_decode_utf8(sl->buf + pos, sl->gap - pos, &cp0);
+	while (pos + len < sl->blen) {
+		size_t end = pos + len < sl->gap ? sl->gap : sl->blen;
+		size_t n = grapheme_decode_utf8(sl_at(sl, pos + len),
+		    end - (pos + len), &cp1);
+
+		if (grapheme_is_character_break(cp0, cp1, &state))
+			break;
+		len += n;
+		cp0 = cp1;
+	}
+
+	return len;
+}
+
 size_t
 sl_postobyte(struct slackline *sl, size_t pos)
 {
-	char *ptr = &sl->buf[0];
-	size_t byte = 0;
+	if (pos < sl->ggap)
+		return sl->gidx[pos];
+	return sl->gblen - sl->gidx[pos + GIDX_GAPLEN(sl)];
+}
+
+/* move the gap of the grapheme index in front of entry pos */
+static void
+sl_gidx_gap(struct slackline *sl, size_t pos)
+{
+	size_t *gidx = sl->gidx, gap = GIDX_GAPLEN(sl);
+
+	for (; sl->ggap > pos; sl->ggap--)
+		gidx[sl->ggap - 1 + gap] = sl->gblen - gidx[sl->ggap - 1];
+	for (; sl->ggap < pos; sl->ggap++)
+		gidx[sl->ggap] = sl->gblen - gidx[sl->ggap + gap];
+}
+
+/* returns the first rune, which starts at or behind byte */
+static size_t
+sl_bytetopos(struct slackline *sl, size_t byte)
+{
+	size_t lo = 0, hi = sl->rlen;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (sl_postobyte(sl, mid) < byte)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Update the grapheme index after the bytes of the runes [r0, r1) were
+ * replaced by len new bytes.  The graphemes around the change are segmented
+ * again, until a boundary lines up with an untouched one behind the change.
+ * The gap of the index moves to the change, the entries behind it keep
+ * their distance to the end of the line.  So, edits take time depending on
+ * the size of the change and its distance to the last one instead of the
+ * length of the line.
+ */
+static int
+sl_reindex(struct slackline *sl, size_t r0, size_t r1, size_t len)
+{
+	size_t rs = r0 > 0 ? r0 - 1 : 0;	/* may join the new bytes */
+	size_t b1 = sl_postobyte(sl, r1);
+	size_t end = sl_postobyte(sl, r0) + len;	/* end of new bytes */
+	size_t k = r1, m = 0, rlen, b;
+
+#define SHIFT(i) (sl_postobyte(sl, (i)) - b1 + end)
+
+	if (sl->blen == 0) {
+		sl->rlen = 0;
+		sl->gidx[0] = 0;
+		sl->ggap = 1;
+		sl->gblen = 0;
+		return 0;
+	}
+
+	/* count the new boundaries up to an old one behind the change */
+	while (SHIFT(k) <= sl_postobyte(sl, rs))
+		k++;
+	for (b = sl_postobyte(sl, rs);;) {
+		size_t n = sl_ascii_graphemes(sl, b);
+
+		/* every byte of an ASCII run is a boundary */
+		if (n > 0) {
+			if (SHIFT(k) <= b + n) {
+				m += SHIFT(k) - b - 1;
+				break;
+			}
+			m += n;
+			b += n;
+			continue;
+		}
+
+		b += sl_next_break(sl, b);
+		while (SHIFT(k) < b)
+			k++;
+		if (SHIFT(k) == b)
+			break;
+		m++;
+	}
+
+#undef SHIFT
+
+	/* the untouched entries from k on go behind the gap */
+	sl_gidx_gap(sl, k);
+	rlen = sl->rlen - (k - rs - 1) + m;
+	if (rlen + 1 > sl->gsize) {
+		size_t size = sl->gsize, tail = sl->rlen + 1 - k;
+		size_t *gidx;
+
+		while (rlen + 1 > size)
+			size *= 2;
+		if ((gidx = realloc(sl->gidx, size * sizeof *gidx)) == NULL)
+			return -1;
+
+		/* the entries behind the gap belong to the end of gidx */
+		memmove(gidx + size - tail, gidx + sl->gsize - tail,
+		    tail * sizeof *gidx);
+
+		sl->gidx = gidx;
+		sl->gsize = size;
+	}
+
+	/* replace the entries in front of the gap by the new boundaries */
+	sl->gidx[0] = 0;	/* the gap may start at 0 */
+	b = sl->gidx[rs];
+	for (size_t i = rs + 1; i < rs + 1 + m;) {
+		size_t n = sl_ascii_graphemes(sl, b);
 
-	for (;pos > 0; pos--)
-		byte += grapheme_next_character_break_utf8(ptr+byte,
-		    sl->blen-byte);
+		if (n == 0) {
+			b += sl_next_break(sl, b);
+			sl->gidx[i++] = b;
+		}
+		while (n-- > 0 && i < rs + 1 + m)
+			sl->gidx[i++] = ++b;
+	}
 
-	return byte;
+	sl->ggap = rs + 1 + m;
+	sl->rlen = rlen;
+	sl->gblen = sl->blen;
+	return 0;
 }
 
 char *
@@ -108,28 +392,78 @@ sl_postoptr(struct slackline *sl, size_t pos)
 	return &sl->buf[sl_postobyte(sl, pos)];
 }
 
+/* remove the runes [rfrom, rto) by growing the gap over them */
 void
-sl_backspace(struct slackline *sl)
+sl_delete_range(struct slackline *sl, size_t rfrom, size_t rto)
 {
-	char *ncur;
+	size_t from, to;
 
-	if (sl->rcur == 0)
+	if (rto > sl->rlen)
+		rto = sl->rlen;
+	if (rfrom >= rto)
 		return;
 
-	ncur = sl_postoptr(sl, sl->rcur - 1);
+	from = sl_postobyte(sl, rfrom);
+	to = sl_postobyte(sl, rto);
 
-	if (sl->rcur < sl->rlen)
-		memmove(ncur, sl->ptr, sl->last - sl->ptr);
+	sl_gap(sl, to);
+	sl->gap = from;
+	sl->blen -= to - from;
+	sl->last = sl->buf + sl->blen;
+	if (sl->gap == sl->blen)
+		sl->buf[sl->blen] = '\0';
 
-	sl->rcur--;
-	sl->rlen--;
+	if (sl->bcur >= to)
+		sl->bcur -= to - from;
+	else if (sl->bcur > from)
+		sl->bcur = from;
+
+	/* removing bytes never needs more index entries */
+	sl_reindex(sl, rfrom, rto, 0);
+	sl->rcur = sl_bytetopos(sl, sl->bcur);
 	sl->bcur = sl_postobyte(sl, sl->rcur);
-	sl->blen = sl_postobyte(sl, sl->rlen);
+	sl->ptr = sl->buf + sl->bcur;
+}
 
-	sl->last -= sl->ptr - ncur;
-	*sl->last = '\0';
+void
+sl_backspace(struct slackline *sl)
+{
+	if (sl->rcur > 0)
+		sl_delete_range(sl, sl->rcur - 1, sl->rcur);
+}
 
-	sl->ptr = ncur;
+static void
+sl_reverse(char *a, char *b)
+{
+	for (char tmp; a < --b; a++) {
+		tmp = *a;
+		*a = *b;
+		*b = tmp;
+	}
+}
+
+/* swap the two runes in front of the cursor */
+void
+sl_transpose(struct slackline *sl)
+{
+	char *a, *b, *c;
+
+	if (sl->rcur < 2)
+		return;
+
+	/* both runes are in front of the gap */
+	sl_gap(sl, sl->bcur);
+	a = sl_postoptr(sl, sl->rcur - 2);
+	b = sl_postoptr(sl, sl->rcur - 1);
+	c = sl_postoptr(sl, sl->rcur);
+
+	/* rotate both runes in place */
+	sl_reverse(a, b);
+	sl_reverse(b, c);
+	sl_reverse(a, c);
+
+	sl_reindex(sl, sl->rcur - 2, sl->rcur, c - a);
+	sl->rcur = sl_bytetopos(sl, sl->bcur);
 }
 
 void
@@ -157,46 +491,104 @@ sl_move(struct slackline *sl, enum direction dir)
 	sl->ptr = sl->buf + sl->bcur;
 }
 
-static void
-sl_default(struct slackline *sl, int key)
+/* returns the first rune of the word in front of the cursor */
+static size_t
+sl_word_start(struct slackline *sl)
 {
-	switch (key) {
-	case ESC_KEY:
-		sl->esc = ESC;
-		break;
-	case CTRL_U:
-		sl_reset(sl);
-		break;
-	case CTRL_W: /* erase previous word */
-		while (sl->rcur != 0 && strchr(IS_WORD_BREAK, *(sl->ptr-1)) != NULL)
-			sl_backspace(sl);
-		while (sl->rcur != 0 && strchr(IS_WORD_BREAK, *(sl->ptr-1)) == NULL)
-			sl_backspace(sl);
-		break;
-	case BACKSPACE:
-	case VT_BACKSPACE:
-		sl_backspace(sl);
-		break;
-	default:
-		break;
-	}
+	size_t r = sl->rcur;
+
+	/* test the last byte of each rune, like for ASCII */
+#define BREAK(r) \
+	(strchr(IS_WORD_BREAK, *sl_at(sl, sl_postobyte(sl, (r)) - 1)) != NULL)
+	while (r != 0 && BREAK(r))
+		r--;
+	while (r != 0 && !BREAK(r))
+		r--;
+#undef BREAK
+
+	return r;
+}
+
+/* bindings of every mode, see SL_DEFAULT_KEYS */
+int
+sl_key_esc(struct slackline *sl, int key)
+{
+	(void)key;
+	sl->esc = ESC;
+	return 0;
 }
 
+int
+sl_key_kill(struct slackline *sl, int key)
+{
+	(void)key;
+	sl_delete_range(sl, 0, sl->rlen);
+	return 0;
+}
+
+/* CTRL+W: erase the previous word */
+int
+sl_key_word(struct slackline *sl, int key)
+{
+	(void)key;
+	sl_delete_range(sl, sl_word_start(sl), sl->rcur);
+	return 0;
+}
+
+int
+sl_key_backspace(struct slackline *sl, int key)
+{
+	(void)key;
+	sl_backspace(sl);
+	return 0;
+}
+
+static sl_binding *const sl_default_keys[SL_KEYS] = {
+	SL_DEFAULT_KEYS,
+	[ESC_KEY] = sl_key_esc,
+};
+
+/* the keymap of every mode, the vi normal mode has its own engine */
+static sl_binding *const *const sl_keymaps[] = {
+	[SL_DEFAULT] = sl_default_keys,
+	[SL_EMACS] = sl_emacs_keys,
+	[SL_VI] = sl_vi_keys,
+};
+
 static int
 sl_esc(struct slackline *sl, int key)
 {
-	/* handle escape sequences */
+	/* handle escape sequences, returns 1 if key was part of one */
 	switch (sl->esc) {
 	case ESC_NONE:
 		break;
 	case ESC:
+		/* an ESC of a sequence does not leave the vi insert mode */
+		if (key == '[' && sl->vi.escaped) {
+			sl->vi.insert = true;
+			if (sl->vi.stepped)
+				sl_move(sl, RIGHT);
+		}
+		sl->vi.escaped = false;
+
 		sl->esc = key == '[' ? ESC_BRACKET : ESC_NONE;
-		return 1;
+
+		/* vi takes the key behind a single ESC as a command */
+		return key == '[' || sl->mode != SL_VI ? 1 : 0;
 	case ESC_BRACKET:
+		/* pasted text only ends with ESC [ 201 ~ */
+		if (sl->paste && (key < '0' || key > '9')) {
+			sl->esc = ESC_NONE;
+			return 1;
+		}
+
 		switch (key) {
 		case 'A':	/* up    */
+			sl->esc = ESC_NONE;
+			return sl_history_prev(sl) == -1 ? -1 : 1;
 		case 'B':	/* down  */
-			break;
+			sl->esc = ESC_NONE;
+			return sl_history_next(sl) == -1 ? -1 : 1;
 		case 'C':	/* right */
 			sl_move(sl, RIGHT);
 			break;
@@ -210,10 +602,7 @@ sl_esc(struct slackline *sl, int key)
 			sl_move(sl, END);
 			break;
 		case 'P':	/* delete */
-			if (sl->rcur == sl->rlen)
-				break;
-			sl_move(sl, RIGHT);
-			sl_backspace(sl);
+			sl_delete_range(sl, sl->rcur, sl->rcur + 1);
 			break;
 		case '0':
 		case '1':
@@ -225,105 +614,187 @@ sl_esc(struct slackline *sl, int key)
 		case '7':
 		case '8':
 		case '9':
-			sl->nummod = key;
+			sl->nummod = key - '0';
 			sl->esc = ESC_BRACKET_NUM;
 			return 1;
 		}
 		sl->esc = ESC_NONE;
 		return 1;
 	case ESC_BRACKET_NUM:
-		switch(key) {
-		case '~':
-			switch(sl->nummod) {
-			case '1':	/* Home */
-			case '7':
-				sl_move(sl, HOME);
-				break;
-			case '4':	/* End */
-			case '8':
-				sl_move(sl, END);
-				break;
-			case '3':	/* Delete */
-				if (sl->rcur == sl->rlen)
-					break;
-				sl_move(sl, RIGHT);
-				sl_backspace(sl);
-				break;
-			}
-			sl->esc = ESC_NONE;
+		if (key >= '0' && key <= '9') {
+			sl->nummod = sl->nummod * 10 + key - '0';
 			return 1;
 		}
+		sl->esc = ESC_NONE;
+		if (key != '~')		/* ignore unknown sequences */
+			return 1;
+		if (sl->paste && sl->nummod != 201)
+			return 1;
+
+		switch (sl->nummod) {
+		case 1:		/* Home */
+		case 7:
+			sl_move(sl, HOME);
+			break;
+		case 4:		/* End */
+		case 8:
+			sl_move(sl, END);
+			break;
+		case 3:		/* Delete */
+			sl_delete_range(sl, sl->rcur, sl->rcur + 1);
+			break;
+		case 5:		/* Page Up, the caller scrolls */
+			sl->page--;
+			break;
+		case 6:		/* Page Down */
+			sl->page++;
+			break;
+		case 200:	/* start of bracketed paste */
+			sl->paste = true;
+			break;
+		case 201:	/* end of bracketed paste */
+			sl->paste = false;
+			break;
+		}
+		return 1;
 	}
 
 	return 0;
 }
 
+/* insert len bytes of str in front of the cursor */
+static int
+sl_insert(struct slackline *sl, const char *str, size_t len)
+{
+	if (sl->blen + len >= sl->bufsize) {
+		size_t size = sl->bufsize;
+		size_t tail = sl->blen - sl->gap;
+		char *nbuf;
+
+		while (sl->blen + len >= size)
+			size *= 2;
+		if ((nbuf = realloc(sl->buf, size)) == NULL)
+			return -1;
+
+		/* the text behind the gap belongs to the end of the buffer */
+		memmove(nbuf + size - tail, nbuf + sl->bufsize - tail, tail);
+
+		sl->buf = nbuf;
+		sl->bufsize = size;
+	}
+
+	sl_gap(sl, sl->bcur);
+	memcpy(sl->buf + sl->gap, str, len);
+
+	sl->gap  += len;
+	sl->bcur += len;
+	sl->blen += len;
+	if (sl->gap == sl->blen)
+		sl->buf[sl->blen] = '\0';
+
+	if (sl_reindex(sl, sl->rcur, sl->rcur, len) == -1)
+		return -1;
+
+	/* the cursor stays on a boundary, if the new text joined the next rune */
+	sl->rcur = sl_bytetopos(sl, sl->bcur);
+	sl->bcur = sl_postobyte(sl, sl->rcur);
+	sl->ptr = sl->buf + sl->bcur;
+	sl->last = sl->buf + sl->blen;
+
+	return 0;
+}
+
+/* replace the whole line with len bytes of str */
+int
+sl_set(struct slackline *sl, const char *str, size_t len)
+{
+	sl_delete_range(sl, 0, sl->rlen);
+	sl->ubuf_len = 0;
+
+	return sl_insert(sl, str, len);
+}
+
 int
 sl_keystroke(struct slackline *sl, int key)
 {
 	uint_least32_t cp;
+	sl_binding *b;
+	int ret;
 
 	if (sl == NULL || sl->rlen < sl->rcur)
 		return -1;
-	if (sl_esc(sl, key))
-		return 0;
+	if (sl->hist.search && (ret = sl_history_search_key(sl, key)) != 0)
+		return ret == -1 ? -1 : 0;
+	if ((ret = sl_esc(sl, key)) != 0)
+		return ret == -1 ? -1 : 0;
+	if (!SL_INSERTING(sl))
+		return sl_vi_normal(sl, key);
 	if (!iscntrl((unsigned char) key))
 		goto compose;
 
-	switch (sl->mode) {
-	case SL_DEFAULT:
-		sl_default(sl, key);
-		break;
-	case SL_EMACS:
-		sl_default(sl, key);
-		sl_emacs(sl, key);
-		break;
-	case SL_VI:
-		/* TODO: implement vi-mode */
-		break;
+	/* pasted text bypasses all key bindings */
+	if (sl->paste) {
+		if (key != ESC_KEY)
+			goto compose;
+		sl->esc = ESC;
+		return 0;
 	}
-	return 0;
+
+	/* one lookup in the keymap of the mode */
+	if (key < 0 || key >= SL_KEYS ||
+	    (b = sl_keymaps[sl->mode][key]) == NULL)
+		return 0;
+	return b(sl, key);
 
 compose:
+	/* ASCII needs no decoding */
+	if (sl->ubuf_len == 0 && key >= ' ' && key <= '~') {
+		sl->ubuf[0] = key;
+		return sl_insert(sl, sl->ubuf, 1);
+	}
+
 	/* byte-wise composing of UTF-8 runes */
 	sl->ubuf[sl->ubuf_len++] = key;
 	if (grapheme_decode_utf8(sl->ubuf, sl->ubuf_len, &cp) > sl->ubuf_len ||
 	    cp == GRAPHEME_INVALID_CODEPOINT)
 		return 0;
 
-	if (sl->blen + sl->ubuf_len >= sl->bufsize) {
-		char *nbuf;
-
-		if ((nbuf = realloc(sl->buf, sl->bufsize * 2)) == NULL)
-			return -1;
+	if (sl_insert(sl, sl->ubuf, sl->ubuf_len) == -1)
+		return -1;
+	sl->ubuf_len = 0;
 
-		sl->ptr = nbuf + (sl->ptr - sl->buf);
-		sl->last = nbuf + (sl->last - sl->buf);
-		sl->buf = nbuf;
-		sl->bufsize *= 2;
-	}
+	return 0;
+}
 
-	/* add character to buffer */
-	if (sl->rcur < sl->rlen) {	/* insert into buffer */
-		char *cur = sl_postoptr(sl, sl->rcur);
-		char *end = sl_postoptr(sl, sl->rlen);
-		char *ncur = cur + sl->ubuf_len;
+/*
+ * Feed len bytes of keyboard input into sl.  Runs of printable ASCII
+ * characters outside of escape sequences are inserted at once.
+ */
+int
+sl_input(struct slackline *sl, const char *buf, size_t len)
+{
+	size_t i = 0;
 
-		memmove(ncur, cur, end - cur);
-	}
+	if (sl == NULL || sl->rlen < sl->rcur)
+		return -1;
 
-	memcpy(sl_postoptr(sl, sl->rcur), sl->ubuf, sl->ubuf_len);
+	while (i < len) {
+		size_t n = 0;
 
-	sl->ptr  += sl->ubuf_len;
-	sl->last += sl->ubuf_len;
-	sl->bcur += sl->ubuf_len;
-	sl->blen += sl->ubuf_len;
-	sl->ubuf_len = 0;
+		if (sl->esc == ESC_NONE && sl->ubuf_len == 0 &&
+		    !sl->hist.search && SL_INSERTING(sl))
+			n = sl_ascii(buf + i, len - i);
 
-	sl->rcur++;
-	sl->rlen++;
+		if (n > 0) {
+			if (sl_insert(sl, buf + i, n) == -1)
+				return -1;
+			i += n;
+			continue;
+		}
 
-	*sl->last = '\0';
+		if (sl_keystroke(sl, buf[i++]) == -1)
+			return -1;
+	}
 
 	return 0;
 }
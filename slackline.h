@@ -4,12 +4,76 @@
 enum esc_seq {ESC_NONE, ESC, ESC_BRACKET, ESC_BRACKET_NUM};
 enum mode {SL_DEFAULT, SL_EMACS, SL_VI};
 
+/* input history, see slackline_history.c */
+#define SL_QUERYSIZE 128
+
+struct sl_entry {
+	size_t off;	/* first byte of the entry in data */
+	size_t len;
+};
+
+/* ascending sequence numbers of the entries containing a trigram */
+struct sl_posting {
+	size_t *seq;
+	size_t len;
+	size_t size;
+};
+
+struct sl_history {
+	char *data;		/* arena of all entries */
+	size_t size;		/* capacity of data */
+	size_t head;		/* byte position of the next entry */
+
+	struct sl_entry *ent;	/* ring of entries */
+	size_t nent;		/* capacity of ent */
+	size_t first;		/* oldest entry */
+	size_t count;		/* amount of entries */
+	size_t pos;		/* recalled entry, count for a new line */
+	size_t seq;		/* sequence number of the next entry */
+
+	const char *src;	/* older lines, which are not loaded yet */
+	size_t srclen;
+
+	char *draft;		/* the new line, while browsing the history */
+	size_t dlen;
+	size_t dsize;
+
+	/* incremental reverse search */
+	struct sl_posting *index;	/* trigram hash of all entries */
+	bool search;		/* search mode is active */
+	bool failed;		/* no entry matches query */
+	char query[SL_QUERYSIZE];
+	size_t qlen;
+	size_t spos;		/* pos at the start of the search */
+};
+
+/* state of the vi mode, see slackline_vi.c */
+struct sl_vi {
+	bool insert;		/* insert mode instead of normal mode */
+	bool escaped;		/* the last key was the ESC into normal mode */
+	bool stepped;		/* that ESC moved the cursor one rune back */
+	int op;			/* pending operator d or c, 0 for none */
+	size_t count;		/* count of the next command, 0 for none */
+	size_t opcount;		/* count in front of the operator */
+};
+
+/*
+ * The buffer is a gap buffer.  The text in front of the gap starts at buf,
+ * the text behind it ends at the end of the buffer.  So, edits at the cursor
+ * don't move the rest of the line.  sl_buf() closes the gap and returns the
+ * line as one string.
+ *
+ * ptr and last are just buf plus bcur and blen.  While the gap is open,
+ * they may point into the gap instead of the text, so only dereference them
+ * after sl_buf().
+ */
 struct slackline {
 	/* buffer */
 	char *buf;
-	char *ptr;	/* ptr of cursor */
-	char *last;	/* ptr of last byte of string */
+	char *ptr;	/* buf + bcur */
+	char *last;	/* buf + blen */
 	size_t bufsize;
+	size_t gap;	/* byte position of the gap */
 
 	/* byte positions */
 	size_t bcur;	/* first byte of the rune of the cursor */
@@ -19,20 +83,42 @@ struct slackline {
 	size_t rcur;	/* cursor */
 	size_t rlen;	/* amount of runes */
 
+	/*
+	 * Grapheme index, the first byte of every rune and blen for rlen.  It
+	 * has a gap like the buffer.  The entries in front of it are byte
+	 * positions, the ones behind it count back from gblen and sit at the
+	 * end of gidx.  So, edits don't touch the entries of the rest of the
+	 * line.  Use sl_postobyte() to read it.
+	 */
+	size_t *gidx;
+	size_t gsize;	/* amount of allocated entries */
+	size_t ggap;	/* amount of entries in front of the gap */
+	size_t gblen;	/* blen at the last update of the index */
+
 	enum esc_seq esc;
-	char nummod;
+	unsigned int nummod;	/* number of an ESC [ n ~ sequence */
+	bool paste;		/* inside of a bracketed paste */
+	int page;		/* requested pages up (< 0) or down (> 0) */
 
 	/* UTF-8 handling */
 	char ubuf[6];	/* UTF-8 buffer */
 	size_t ubuf_len;
 
 	enum mode mode;
+	struct sl_vi vi;
+
+	struct sl_history hist;
 };
 
 struct slackline *sl_init(void);
 void sl_free(struct slackline *sl);
 void sl_reset(struct slackline *sl);
 int sl_keystroke(struct slackline *sl, int key);
+int sl_input(struct slackline *sl, const char *buf, size_t len);
+char *sl_buf(struct slackline *sl);
+void sl_copy(struct slackline *sl, char *dst);
 void sl_mode(struct slackline *sl, enum mode mode);
+int sl_history_add(struct slackline *sl, const char *line, size_t len);
+void sl_history_source(struct slackline *sl, const char *src, size_t len);
 
 #endif
@@ -16,55 +16,109 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
 
 #include "slackline.h"
 #include "slackline_internals.h"
 
-void
-sl_emacs(struct slackline *sl, int key)
+static int
+sl_emacs_home(struct slackline *sl, int key)
 {
-	char tmp;
+	(void)key;
+	sl_move(sl, HOME);
+	return 0;
+}
+
+static int
+sl_emacs_left(struct slackline *sl, int key)
+{
+	(void)key;
+	sl_move(sl, LEFT);
+	return 0;
+}
 
-	switch (key) {
-	case ESC_KEY:
-		sl->esc = ESC;
-		break;
-	case CTRL_A:	/* start of line */
-		sl_move(sl, HOME);
-		break;
-	case CTRL_B:	 /* previous char */
-		sl_move(sl, LEFT);
-		break;
-	case CTRL_D:	/* delete char in front of the cursor or exit */
-		if (sl->rcur < sl->rlen) {
-			sl_move(sl, RIGHT);
-			sl_backspace(sl);
-		} else {
-			exit(EXIT_SUCCESS);
-		}
-		break;
-	case CTRL_E:	/* end of line */
-		sl_move(sl, END);
-		break;
-	case CTRL_F:	/* next char */
-		sl_move(sl, RIGHT);
-		break;
-	case CTRL_K:	/* delete line from cursor to end */
-		for (int i = sl->rlen - sl->rcur; i > 0; --i) {
-			sl_move(sl, RIGHT);
-			sl_backspace(sl);
-		}
-		break;
-	case CTRL_T:	/* swap last two chars */
-		if (sl->rcur >= 2) {
-			tmp = *sl_postoptr(sl, sl->rcur-1);
-			sl->buf[sl->rcur-1] = *sl_postoptr(sl, sl->rcur-2);
-			sl->buf[sl->rcur-2] = tmp;
-		}
-		break;
-	default:
-		break;
+/* delete char in front of the cursor or exit */
+static int
+sl_emacs_delete(struct slackline *sl, int key)
+{
+	(void)key;
+	if (sl->rcur < sl->rlen) {
+		sl_delete_range(sl, sl->rcur, sl->rcur + 1);
+	} else {
+		exit(EXIT_SUCCESS);
 	}
+	return 0;
+}
+
+static int
+sl_emacs_end(struct slackline *sl, int key)
+{
+	(void)key;
+	sl_move(sl, END);
+	return 0;
+}
+
+static int
+sl_emacs_right(struct slackline *sl, int key)
+{
+	(void)key;
+	sl_move(sl, RIGHT);
+	return 0;
+}
+
+/* delete line from cursor to end */
+static int
+sl_emacs_kill(struct slackline *sl, int key)
+{
+	(void)key;
+	sl_delete_range(sl, sl->rcur, sl->rlen);
+	return 0;
 }
+
+/* swap last two chars */
+static int
+sl_emacs_transpose(struct slackline *sl, int key)
+{
+	(void)key;
+	sl_transpose(sl);
+	return 0;
+}
+
+static int
+sl_emacs_prev(struct slackline *sl, int key)
+{
+	(void)key;
+	return sl_history_prev(sl);
+}
+
+static int
+sl_emacs_next(struct slackline *sl, int key)
+{
+	(void)key;
+	return sl_history_next(sl);
+}
+
+/* incremental reverse search of the history */
+static int
+sl_emacs_search(struct slackline *sl, int key)
+{
+	(void)key;
+	return sl_history_search(sl);
+}
+
+sl_binding *const sl_emacs_keys[SL_KEYS] = {
+	SL_DEFAULT_KEYS,
+	[ESC_KEY] = sl_key_esc,
+	[CTRL_A] = sl_emacs_home,
+	[CTRL_B] = sl_emacs_left,
+	[CTRL_D] = sl_emacs_delete,
+	[CTRL_E] = sl_emacs_end,
+	[CTRL_F] = sl_emacs_right,
+	[CTRL_K] = sl_emacs_kill,
+	[CTRL_T] = sl_emacs_transpose,
+	[CTRL_P] = sl_emacs_prev,
+	[CTRL_N] = sl_emacs_next,
+	[CTRL_R] = sl_emacs_search,
+};
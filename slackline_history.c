@@ -0,0 +1,427 @@
+/*
+ * Copyright (c) 2023 Jan Klemkow <j.klemkow@wemelug.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slackline.h"
+#include "slackline_internals.h"
+
+/*
+ * All entries live in one arena of HIST_SIZE bytes, which is filled like a
+ * ring.  A new entry, which does not fit in front of the end of the arena,
+ * starts at the beginning again and overwrites the oldest entries.  The
+ * history keeps at most HIST_ENTRIES entries, as many as lchat keeps in
+ * its .history file.  The arena takes them with about 40 bytes each.
+ */
+#define HIST_SIZE	(4 * 1024 * 1024)
+#define HIST_ENTRIES	100000
+
+/*
+ * The reverse search looks up the trigrams of the query in a hash of
+ * HIST_BUCKETS posting lists.  Postings of lost entries are removed lazily.
+ */
+#define HIST_BUCKETS	4096
+
+#define ENTRY(h, i)	(&(h)->ent[((h)->first + (i)) % (h)->nent])
+
+static void
+sl_history_drop(struct sl_history *h)
+{
+	h->first = (h->first + 1) % h->nent;
+	h->count--;
+}
+
+static struct sl_posting *
+sl_trigram(struct sl_history *h, const char *str)
+{
+	uint_least32_t t = (unsigned char)str[0] << 16 |
+	    (unsigned char)str[1] << 8 | (unsigned char)str[2];
+
+	return &h->index[((t * 2654435761u) & 0xffffffff) >> 20];
+}
+
+/* returns the first posting of an entry, which is still in the history */
+static size_t
+sl_posting_live(struct sl_history *h, struct sl_posting *p)
+{
+	size_t oldest = h->seq - h->count;
+	size_t lo = 0, hi = p->len;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (p->seq[mid] < oldest)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static int
+sl_posting_add(struct sl_history *h, struct sl_posting *p, size_t seq)
+{
+	if (p->len > 0 && p->seq[p->len - 1] == seq)
+		return 0;
+
+	/* remove postings of lost entries, before we grow the list */
+	if (p->len == p->size) {
+		size_t live = sl_posting_live(h, p);
+
+		if (live > 0)
+			memmove(p->seq, p->seq + live,
+			    (p->len - live) * sizeof *p->seq);
+		p->len -= live;
+	}
+
+	if (p->len == p->size) {
+		size_t size = p->size == 0 ? 8 : p->size * 2;
+		size_t *nseq;
+
+		if ((nseq = realloc(p->seq, size * sizeof *nseq)) == NULL)
+			return -1;
+		p->seq = nseq;
+		p->size = size;
+	}
+	p->seq[p->len++] = seq;
+
+	return 0;
+}
+
+/*
+ * Load the newest lines of the source, which fit into the arena.  Only this
+ * part of the source gets scanned, backwards from its end.
+ */
+static int
+sl_history_load(struct slackline *sl)
+{
+	struct sl_history *h = &sl->hist;
+	const char *src = h->src, *pos = h->src + h->srclen;
+	size_t size = 0;
+
+	h->src = NULL;
+
+	/* the newline behind the last line terminates it */
+	if (pos > src && pos[-1] == '\n')
+		pos--;
+
+	for (size_t lines = 0; pos > src && lines < h->nent; lines++) {
+		const char *start = pos;
+
+		while (start > src && start[-1] != '\n')
+			start--;
+		if (size + (pos - start) > h->size)
+			break;
+		size += pos - start;
+		pos = start > src ? start - 1 : start;
+	}
+	if (pos > src)
+		pos++;
+
+	/* add the lines from the oldest to the newest one */
+	for (const char *end = src + h->srclen; pos < end;) {
+		const char *nl = memchr(pos, '\n', end - pos);
+
+		if (sl_history_add(sl, pos, (nl != NULL ? nl : end) - pos) == -1)
+			return -1;
+		if (nl == NULL)
+			break;
+		pos = nl + 1;
+	}
+
+	return 0;
+}
+
+/* allocate the history on its first use */
+static int
+sl_history_init(struct slackline *sl)
+{
+	struct sl_history *h = &sl->hist;
+
+	if (h->data != NULL)
+		return 0;
+
+	if ((h->data = malloc(HIST_SIZE)) == NULL)
+		return -1;
+	if ((h->ent = malloc(HIST_ENTRIES * sizeof *h->ent)) == NULL) {
+		free(h->data);
+		h->data = NULL;
+		return -1;
+	}
+	if ((h->index = calloc(HIST_BUCKETS, sizeof *h->index)) == NULL) {
+		free(h->data);
+		free(h->ent);
+		h->data = NULL;
+		return -1;
+	}
+	h->size = HIST_SIZE;
+	h->nent = HIST_ENTRIES;
+
+	if (h->src != NULL)
+		return sl_history_load(sl);
+
+	return 0;
+}
+
+/*
+ * Use the len bytes of newline separated lines at src as older history.
+ * They are loaded on the first use of the history.  src must stay valid
+ * until then.
+ */
+void
+sl_history_source(struct slackline *sl, const char *src, size_t len)
+{
+	sl->hist.src = len > 0 ? src : NULL;
+	sl->hist.srclen = len;
+}
+
+/* add len bytes of line as newest entry to the history */
+int
+sl_history_add(struct slackline *sl, const char *line, size_t len)
+{
+	struct sl_history *h = &sl->hist;
+	struct sl_entry *e;
+	size_t seq;
+
+	if (sl_history_init(sl) == -1)
+		return -1;
+
+	/* skip empty lines, repetitions and lines bigger than the arena */
+	if (len == 0 || len > h->size)
+		goto out;
+	if (h->count > 0) {
+		e = ENTRY(h, h->count - 1);
+		if (e->len == len && memcmp(h->data + e->off, line, len) == 0)
+			goto out;
+	}
+
+	/* the oldest entries behind head are lost when we wrap around */
+	if (h->head + len > h->size) {
+		while (h->count > 0 && ENTRY(h, 0)->off >= h->head)
+			sl_history_drop(h);
+		h->head = 0;
+	}
+	while (h->count > 0 && ENTRY(h, 0)->off >= h->head &&
+	    ENTRY(h, 0)->off < h->head + len)
+		sl_history_drop(h);
+	if (h->count == h->nent)
+		sl_history_drop(h);
+
+	e = ENTRY(h, h->count);
+	e->off = h->head;
+	e->len = len;
+	memcpy(h->data + h->head, line, len);
+	h->head += len;
+	h->count++;
+
+	seq = h->seq++;
+	for (size_t i = 0; i + 3 <= len; i++)
+		if (sl_posting_add(h, sl_trigram(h, line + i), seq) == -1)
+			return -1;
+ out:
+	h->pos = h->count;
+	return 0;
+}
+
+/* replace the edited line with entry pos of the history */
+static int
+sl_history_recall(struct slackline *sl, size_t pos)
+{
+	struct sl_history *h = &sl->hist;
+
+	/* stash the edited line, before we leave it */
+	if (h->pos == h->count) {
+		if (sl->blen + 1 > h->dsize) {
+			char *draft;
+
+			if ((draft = realloc(h->draft, sl->bufsize)) == NULL)
+				return -1;
+			h->draft = draft;
+			h->dsize = sl->bufsize;
+		}
+		sl_copy(sl, h->draft);
+		h->dlen = sl->blen;
+	}
+
+	h->pos = pos;
+	if (pos == h->count)
+		return sl_set(sl, h->draft, h->dlen);
+
+	return sl_set(sl, h->data + ENTRY(h, pos)->off, ENTRY(h, pos)->len);
+}
+
+int
+sl_history_prev(struct slackline *sl)
+{
+	if (sl_history_init(sl) == -1)
+		return -1;
+	if (sl->hist.pos == 0)
+		return 0;
+
+	return sl_history_recall(sl, sl->hist.pos - 1);
+}
+
+int
+sl_history_next(struct slackline *sl)
+{
+	if (sl->hist.pos >= sl->hist.count)
+		return 0;
+
+	return sl_history_recall(sl, sl->hist.pos + 1);
+}
+
+/* returns true, if entry pos contains the query */
+static bool
+sl_history_match(struct sl_history *h, size_t pos)
+{
+	struct sl_entry *e = ENTRY(h, pos);
+
+	for (size_t i = 0; i + h->qlen <= e->len; i++)
+		if (memcmp(h->data + e->off + i, h->query, h->qlen) == 0)
+			return true;
+
+	return false;
+}
+
+/* find the newest entry in front of end, which contains the query */
+static bool
+sl_history_find(struct sl_history *h, size_t end, size_t *pos)
+{
+	struct sl_posting *p = NULL;
+	size_t oldest = h->seq - h->count;
+
+	/* short queries have no trigram, look at every entry */
+	if (h->qlen < 3) {
+		for (*pos = end; (*pos)-- > 0;)
+			if (sl_history_match(h, *pos))
+				return true;
+		return false;
+	}
+
+	/* walk the shortest posting list of all trigrams of the query */
+	for (size_t i = 0; i + 3 <= h->qlen; i++) {
+		struct sl_posting *t = sl_trigram(h, h->query + i);
+
+		if (p == NULL || t->len < p->len)
+			p = t;
+	}
+
+	for (size_t i = p->len, live = sl_posting_live(h, p); i > live; i--) {
+		*pos = p->seq[i - 1] - oldest;
+		if (*pos < end && sl_history_match(h, *pos))
+			return true;
+	}
+
+	return false;
+}
+
+/* show the newest match in front of end */
+static int
+sl_history_update(struct sl_history *h, struct slackline *sl, size_t end)
+{
+	size_t pos;
+
+	h->failed = false;
+	if (h->qlen == 0)
+		return 0;
+
+	if (!sl_history_find(h, end, &pos)) {
+		h->failed = true;
+		return 0;
+	}
+	if (pos == h->pos)
+		return 0;
+
+	return sl_history_recall(sl, pos);
+}
+
+/* start the incremental reverse search */
+int
+sl_history_search(struct slackline *sl)
+{
+	struct sl_history *h = &sl->hist;
+
+	if (sl_history_init(sl) == -1)
+		return -1;
+
+	h->search = true;
+	h->failed = false;
+	h->qlen = 0;
+	h->spos = h->pos;
+
+	return 0;
+}
+
+/*
+ * Handle key in search mode.  Returns 1 if the key was consumed.  Any other
+ * control key ends the search and returns 0, to be processed as usual.
+ */
+int
+sl_history_search_key(struct slackline *sl, int key)
+{
+	struct sl_history *h = &sl->hist;
+	int ret = 0;
+
+	switch (key) {
+	case CTRL_R:	/* next older match */
+		ret = sl_history_update(h, sl, h->pos);
+		break;
+	case CTRL_G:	/* cancel the search */
+		h->search = false;
+		ret = sl_history_recall(sl, h->spos);
+		break;
+	case BACKSPACE:
+	case VT_BACKSPACE:
+		/* remove the last rune of the query and search again */
+		while (h->qlen > 0 &&
+		    ((unsigned char)h->query[--h->qlen] & 0xC0) == 0x80)
+			;
+		ret = sl_history_update(h, sl, h->count);
+		break;
+	default:
+		if (iscntrl((unsigned char) key)) {
+			h->search = false;
+			return 0;
+		}
+		if (h->qlen == sizeof h->query)
+			break;
+
+		/* the current match is still a candidate */
+		h->query[h->qlen++] = key;
+		ret = sl_history_update(h, sl,
+		    h->pos < h->count ? h->pos + 1 : h->count);
+		break;
+	}
+
+	return ret == -1 ? -1 : 1;
+}
+
+void
+sl_history_free(struct sl_history *h)
+{
+	if (h->index != NULL)
+		for (size_t i = 0; i < HIST_BUCKETS; i++)
+			free(h->index[i].seq);
+	free(h->index);
+	free(h->data);
+	free(h->ent);
+	free(h->draft);
+}
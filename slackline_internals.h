@@ -2,6 +2,7 @@
 #define SLACKLINE_INTERNALS_H
 
 struct slackline;
+struct sl_history;
 
 enum direction {LEFT, RIGHT, HOME, END};
 
@@ -11,7 +12,11 @@ enum {
 	CTRL_D = 4,
 	CTRL_E = 5,
 	CTRL_F = 6,
+	CTRL_G = 7,
 	CTRL_K = 11,
+	CTRL_N = 14,
+	CTRL_P = 16,
+	CTRL_R = 18,
 	CTRL_U = 21,
 	CTRL_T = 20,
 	CTRL_W = 23,
@@ -22,10 +27,46 @@ enum {
 	ESC_KEY = 27
 };
 
+/*
+ * A keymap has a binding for every ASCII key.  A binding returns -1 on
+ * error.  SL_DEFAULT_KEYS are the editing keys of every mode, ESC is left
+ * to the mode.
+ */
+#define SL_KEYS 128
+typedef int sl_binding(struct slackline *sl, int key);
+
+#define SL_DEFAULT_KEYS \
+	[CTRL_U] = sl_key_kill, \
+	[CTRL_W] = sl_key_word, \
+	[BACKSPACE] = sl_key_backspace, \
+	[VT_BACKSPACE] = sl_key_backspace
+
+/* keys are inserted, except in the vi normal mode */
+#define SL_INSERTING(sl) \
+	((sl)->mode != SL_VI || (sl)->vi.insert || (sl)->paste)
+
+int sl_key_esc(struct slackline *sl, int key);
+int sl_key_kill(struct slackline *sl, int key);
+int sl_key_word(struct slackline *sl, int key);
+int sl_key_backspace(struct slackline *sl, int key);
+
+extern sl_binding *const sl_emacs_keys[SL_KEYS];
+extern sl_binding *const sl_vi_keys[SL_KEYS];
+int sl_vi_normal(struct slackline *sl, int key);
+
+char *sl_at(struct slackline *sl, size_t pos);
 size_t sl_postobyte(struct slackline *sl, size_t pos);
 char *sl_postoptr(struct slackline *sl, size_t pos);
+void sl_delete_range(struct slackline *sl, size_t rfrom, size_t rto);
 void sl_backspace(struct slackline *sl);
+void sl_transpose(struct slackline *sl);
 void sl_move(struct slackline *sl, enum direction dir);
-void sl_emacs(struct slackline *sl, int key);
+int sl_set(struct slackline *sl, const char *str, size_t len);
+
+int sl_history_prev(struct slackline *sl);
+int sl_history_next(struct slackline *sl);
+int sl_history_search(struct slackline *sl);
+int sl_history_search_key(struct slackline *sl, int key);
+void sl_history_free(struct sl_history *h);
 
 #endif
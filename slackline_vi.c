@@ -0,0 +1,372 @@
+/*
+ * Copyright (c) 2023 Jan Klemkow <j.klemkow@wemelug.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "slackline.h"
+#include "slackline_internals.h"
+
+/* counts above this are ignored */
+#define VI_COUNT_MAX	100000
+
+/*
+ * A motion returns the position one step away from pos.  It is repeated
+ * count times, until the position does not change anymore.  Big motions
+ * take every run of non-space runes as a word.
+ */
+typedef size_t vi_motion(struct slackline *sl, size_t pos, bool big);
+
+struct vi_key {
+	sl_binding *cmd;
+	vi_motion *motion;
+	bool big;
+	bool inclusive;		/* an operator includes the target rune */
+};
+
+/* classes of runes: 0 for space, 1 for word runes and 2 for the rest */
+static int
+vi_class(struct slackline *sl, size_t pos, bool big)
+{
+	unsigned char c = *sl_at(sl, sl_postobyte(sl, pos));
+
+	if (isspace(c))
+		return 0;
+	if (big || c >= 0x80 || isalnum(c) || c == '_')
+		return 1;
+	return 2;
+}
+
+static size_t
+vi_word_next(struct slackline *sl, size_t pos, bool big)
+{
+	int c;
+
+	if (pos >= sl->rlen)
+		return sl->rlen;
+
+	if ((c = vi_class(sl, pos, big)) != 0)
+		while (pos < sl->rlen && vi_class(sl, pos, big) == c)
+			pos++;
+	while (pos < sl->rlen && vi_class(sl, pos, big) == 0)
+		pos++;
+
+	return pos;
+}
+
+static size_t
+vi_word_prev(struct slackline *sl, size_t pos, bool big)
+{
+	int c;
+
+	if (pos == 0)
+		return 0;
+
+	pos--;
+	while (pos > 0 && vi_class(sl, pos, big) == 0)
+		pos--;
+	c = vi_class(sl, pos, big);
+	while (pos > 0 && vi_class(sl, pos - 1, big) == c)
+		pos--;
+
+	return pos;
+}
+
+static size_t
+vi_word_end(struct slackline *sl, size_t pos, bool big)
+{
+	int c;
+
+	if (pos + 1 >= sl->rlen)
+		return pos;
+
+	pos++;
+	while (pos + 1 < sl->rlen && vi_class(sl, pos, big) == 0)
+		pos++;
+	c = vi_class(sl, pos, big);
+	while (pos + 1 < sl->rlen && vi_class(sl, pos + 1, big) == c)
+		pos++;
+
+	return pos;
+}
+
+static size_t
+vi_left(struct slackline *sl, size_t pos, bool big)
+{
+	(void)sl;
+	(void)big;
+	return pos > 0 ? pos - 1 : 0;
+}
+
+static size_t
+vi_right(struct slackline *sl, size_t pos, bool big)
+{
+	(void)big;
+	return pos < sl->rlen ? pos + 1 : sl->rlen;
+}
+
+static size_t
+vi_home(struct slackline *sl, size_t pos, bool big)
+{
+	(void)sl;
+	(void)pos;
+	(void)big;
+	return 0;
+}
+
+/* the first rune, which is not a space */
+static size_t
+vi_first(struct slackline *sl, size_t pos, bool big)
+{
+	(void)big;
+	for (pos = 0; pos < sl->rlen && vi_class(sl, pos, true) == 0;)
+		pos++;
+	return pos;
+}
+
+static size_t
+vi_end(struct slackline *sl, size_t pos, bool big)
+{
+	(void)pos;
+	(void)big;
+	return sl->rlen;
+}
+
+static void
+vi_cursor(struct slackline *sl, size_t pos)
+{
+	sl->rcur = pos;
+	sl->bcur = sl_postobyte(sl, pos);
+	sl->ptr = sl->buf + sl->bcur;
+}
+
+/* count of the command, a count in front of the operator multiplies it */
+static size_t
+vi_count(struct sl_vi *vi)
+{
+	return (vi->count > 0 ? vi->count : 1) *
+	    (vi->opcount > 0 ? vi->opcount : 1);
+}
+
+/* run the pending operator on the runes between the cursor and pos */
+static void
+vi_apply(struct slackline *sl, size_t pos, bool inclusive)
+{
+	size_t from = pos < sl->rcur ? pos : sl->rcur;
+	size_t to = pos < sl->rcur ? sl->rcur : pos;
+
+	if (inclusive && to < sl->rlen)
+		to++;
+	sl_delete_range(sl, from, to);
+
+	if (sl->vi.op == 'c')
+		sl->vi.insert = true;
+	sl->vi.op = 0;
+	sl->vi.opcount = 0;
+}
+
+static void
+vi_motion_key(struct slackline *sl, const struct vi_key *k)
+{
+	vi_motion *motion = k->motion;
+	bool inclusive = k->inclusive;
+	size_t pos = sl->rcur, next;
+
+	/* cw changes a word like ce, without the space behind it */
+	if (sl->vi.op == 'c' && motion == vi_word_next &&
+	    sl->rcur < sl->rlen && vi_class(sl, sl->rcur, false) != 0) {
+		motion = vi_word_end;
+		inclusive = true;
+	}
+
+	for (size_t n = vi_count(&sl->vi); n > 0; n--) {
+		if ((next = motion(sl, pos, k->big)) == pos)
+			break;
+		pos = next;
+	}
+
+	if (sl->vi.op != 0)
+		vi_apply(sl, pos, inclusive);
+	else
+		vi_cursor(sl, pos);
+}
+
+static int
+vi_operator(struct slackline *sl, int key)
+{
+	struct sl_vi *vi = &sl->vi;
+
+	/* dd and cc take the whole line */
+	if (vi->op == key) {
+		vi_cursor(sl, 0);
+		vi_apply(sl, sl->rlen, false);
+		return 0;
+	}
+
+	vi->op = key;
+	vi->opcount = vi->count;
+	return 0;
+}
+
+/* ESC cancels the command and may start an escape sequence */
+static int
+vi_escape(struct slackline *sl, int key)
+{
+	sl->vi.op = 0;
+	sl->vi.opcount = 0;
+	return sl_key_esc(sl, key);
+}
+
+static int
+vi_insert(struct slackline *sl, int key)
+{
+	switch (key) {
+	case 'a':
+		sl_move(sl, RIGHT);
+		break;
+	case 'A':
+		sl_move(sl, END);
+		break;
+	case 'I':
+		vi_cursor(sl, vi_first(sl, 0, true));
+		break;
+	}
+	sl->vi.insert = true;
+	return 0;
+}
+
+/* x, X and s work on count runes */
+static int
+vi_delete(struct slackline *sl, int key)
+{
+	size_t n = vi_count(&sl->vi);
+
+	if (key == 'X')
+		sl_delete_range(sl, n < sl->rcur ? sl->rcur - n : 0, sl->rcur);
+	else
+		sl_delete_range(sl, sl->rcur, sl->rcur + n);
+	if (key == 's')
+		sl->vi.insert = true;
+	return 0;
+}
+
+/* D and C work up to the end of the line, S on the whole line */
+static int
+vi_line(struct slackline *sl, int key)
+{
+	if (key == 'S')
+		vi_cursor(sl, 0);
+	sl_delete_range(sl, sl->rcur, sl->rlen);
+	if (key != 'D')
+		sl->vi.insert = true;
+	return 0;
+}
+
+static int
+vi_history(struct slackline *sl, int key)
+{
+	return key == 'k' ? sl_history_prev(sl) : sl_history_next(sl);
+}
+
+/* enter the normal mode */
+static int
+vi_normal(struct slackline *sl, int key)
+{
+	/* like vi, leave on the text, undone if ESC starts a sequence */
+	sl->vi.insert = false;
+	sl->vi.escaped = true;
+	sl->vi.stepped = sl->rcur > 0;
+	if (sl->vi.stepped)
+		vi_cursor(sl, sl->rcur - 1);
+	return sl_key_esc(sl, key);
+}
+
+/* the keymap of the insert mode */
+sl_binding *const sl_vi_keys[SL_KEYS] = {
+	SL_DEFAULT_KEYS,
+	[ESC_KEY] = vi_normal,
+};
+
+static const struct vi_key vi_keys[SL_KEYS] = {
+	[ESC_KEY]	= {.cmd = vi_escape},
+	['i']		= {.cmd = vi_insert},
+	['a']		= {.cmd = vi_insert},
+	['I']		= {.cmd = vi_insert},
+	['A']		= {.cmd = vi_insert},
+	['x']		= {.cmd = vi_delete},
+	['X']		= {.cmd = vi_delete},
+	['s']		= {.cmd = vi_delete},
+	['D']		= {.cmd = vi_line},
+	['C']		= {.cmd = vi_line},
+	['S']		= {.cmd = vi_line},
+	['d']		= {.cmd = vi_operator},
+	['c']		= {.cmd = vi_operator},
+	['k']		= {.cmd = vi_history},
+	['j']		= {.cmd = vi_history},
+
+	['h']		= {.motion = vi_left},
+	[BACKSPACE]	= {.motion = vi_left},
+	[VT_BACKSPACE]	= {.motion = vi_left},
+	['l']		= {.motion = vi_right},
+	[' ']		= {.motion = vi_right},
+	['0']		= {.motion = vi_home},
+	['^']		= {.motion = vi_first},
+	['$']		= {.motion = vi_end},
+	['w']		= {.motion = vi_word_next},
+	['W']		= {.motion = vi_word_next, .big = true},
+	['b']		= {.motion = vi_word_prev},
+	['B']		= {.motion = vi_word_prev, .big = true},
+	['e']		= {.motion = vi_word_end, .inclusive = true},
+	['E']		= {.motion = vi_word_end, .big = true, .inclusive = true},
+};
+
+/* handle key in the normal mode */
+int
+sl_vi_normal(struct slackline *sl, int key)
+{
+	struct sl_vi *vi = &sl->vi;
+	const struct vi_key *k;
+	int ret = 0;
+
+	if (key < 0 || key >= SL_KEYS)
+		return 0;
+
+	/* a count in front of the command, 0 alone is a motion */
+	if (isdigit(key) && (key != '0' || vi->count > 0)) {
+		if (vi->count * 10 + key - '0' <= VI_COUNT_MAX)
+			vi->count = vi->count * 10 + key - '0';
+		return 0;
+	}
+
+	k = &vi_keys[key];
+	if (k->motion != NULL)
+		vi_motion_key(sl, k);
+	else if (k->cmd != NULL && (vi->op == 0 || k->cmd == vi_operator ||
+	    k->cmd == vi_escape))
+		ret = k->cmd(sl, key);
+	else
+		vi->op = vi->opcount = 0;	/* unknown keys cancel */
+	vi->count = 0;
+
+	/* the cursor rests on the last rune, not behind it */
+	if (!vi->insert && sl->rlen > 0 && sl->rcur >= sl->rlen)
+		vi_cursor(sl, sl->rlen - 1);
+
+	return ret;
+}
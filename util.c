@@ -14,13 +14,30 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#elif defined(__OpenBSD__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+    defined(__DragonFly__) || defined(__APPLE__)
+#define USE_KQUEUE
+#include <sys/event.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <regex.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "util.h"
+
 void
 die(const char *fmt, ...)
 {
@@ -40,31 +57,395 @@ die(const char *fmt, ...)
 	exit(EXIT_FAILURE);
 }
 
+static bool
+watch_stat(struct watch *w)
+{
+	struct stat st;
+	bool exists = stat(w->path, &st) == 0;
+	bool changed;
+
+	if (!exists) {
+		changed = w->exists;
+		w->exists = false;
+		return changed;
+	}
+
+	changed = !w->exists || w->dev != st.st_dev || w->ino != st.st_ino ||
+	    w->size != st.st_size || w->mtime != st.st_mtime;
+
+	w->exists = true;
+	w->dev = st.st_dev;
+	w->ino = st.st_ino;
+	w->size = st.st_size;
+	w->mtime = st.st_mtime;
+
+	return changed;
+}
+
+#ifdef __linux__
+/* (re)register the file itself, its directory tells us about new files */
+static void
+watch_inotify(struct watch *w)
+{
+	/* the watch of a removed file is already gone */
+	if (w->wd != -1)
+		inotify_rm_watch(w->fd, w->wd);
+
+	w->wd = inotify_add_watch(w->fd, w->path, IN_MODIFY);
+}
+#elif defined(USE_KQUEUE)
+/* (re)register the file itself, its directory tells us about new files */
+static void
+watch_kevent(struct watch *w)
+{
+	struct kevent kev;
+
+	if (w->wd != -1 && close(w->wd) == -1)
+		die("close:");
+
+	if ((w->wd = open(w->path, O_RDONLY|O_CLOEXEC)) == -1)
+		return;
+
+	EV_SET(&kev, w->wd, EVFILT_VNODE, EV_ADD|EV_CLEAR, NOTE_WRITE|
+	    NOTE_EXTEND|NOTE_DELETE|NOTE_RENAME|NOTE_ATTRIB, 0, NULL);
+	if (kevent(w->fd, &kev, 1, NULL, 0, NULL) == -1)
+		die("kevent:");
+}
+#endif
+
+/*
+ * Watch path for changes.  If notify is set, w->fd becomes a descriptor for
+ * poll(2), which gets readable on changes of path.  Otherwise, or if the
+ * system lacks inotify(7) and kqueue(2), w->fd is -1 and watch_check()
+ * polls with stat(2) at most once per second.
+ */
+void
+watch_init(struct watch *w, const char *path, bool notify)
+{
+	char *copy;
+
+	memset(w, 0, sizeof *w);
+	w->fd = -1;
+	w->wd = -1;
+	w->dirfd = -1;
+
+	if ((w->path = strdup(path)) == NULL)
+		die("strdup:");
+	if ((copy = strdup(path)) == NULL)
+		die("strdup:");
+	if ((w->name = strdup(basename(copy))) == NULL)
+		die("strdup:");
+	strcpy(copy, path);
+	if ((w->dir = strdup(dirname(copy))) == NULL)
+		die("strdup:");
+	free(copy);
+
+	watch_stat(w);
+	w->polled = time(NULL);
+
+	if (!notify)
+		return;
+#ifdef __linux__
+	if ((w->fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) == -1)
+		die("inotify_init1:");
+	if ((w->dirfd = inotify_add_watch(w->fd, w->dir, IN_CREATE|
+	    IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE)) == -1)
+		die("inotify_add_watch: %s:", w->dir);
+	watch_inotify(w);
+#elif defined(USE_KQUEUE)
+	struct kevent kev;
+
+	if ((w->fd = kqueue()) == -1)
+		die("kqueue:");
+	if ((w->dirfd = open(w->dir, O_RDONLY|O_CLOEXEC)) == -1)
+		die("open: %s:", w->dir);
+	EV_SET(&kev, w->dirfd, EVFILT_VNODE, EV_ADD|EV_CLEAR, NOTE_WRITE, 0, NULL);
+	if (kevent(w->fd, &kev, 1, NULL, 0, NULL) == -1)
+		die("kevent:");
+	watch_kevent(w);
+#endif
+}
+
+/*
+ * Returns true if path was created, removed, replaced or modified since the
+ * last call.  With a notification descriptor, call it when w->fd is
+ * readable.
+ */
 bool
-bell_match(const char *str, const char *regex_file)
+watch_check(struct watch *w)
 {
-	FILE *fh = NULL;
-	char cmd[BUFSIZ];
+	bool event = false;
 
-	if (access(regex_file, R_OK) == -1)
-		return true;
+	if (w->fd == -1) {
+		time_t now = time(NULL);
+
+		if (now == w->polled)
+			return false;
+		w->polled = now;
+
+		return watch_stat(w);
+	}
+#ifdef __linux__
+	union {
+		struct inotify_event ev;
+		char buf[BUFSIZ];
+	} u;
+	bool moved = false;	/* path got another file */
+	ssize_t n;
+
+	while ((n = read(w->fd, u.buf, sizeof u.buf)) > 0) {
+		for (char *p = u.buf; p < u.buf + n; ) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+
+			/* other files of dir only show up by their name */
+			if (ev->wd == w->wd && w->wd != -1) {
+				event = true;
+			} else if (ev->wd == w->dirfd && ev->len > 0 &&
+			    strcmp(ev->name, w->name) == 0) {
+				event = true;
+				moved = true;
+			}
+			p += sizeof *ev + ev->len;
+		}
+	}
+	if (n == -1 && errno != EAGAIN && errno != EINTR)
+		die("read:");
+	if (moved)
+		watch_inotify(w);
+#elif defined(USE_KQUEUE)
+	struct kevent kev[8];
+	struct timespec zero = {0, 0};
+	int n;
+
+	while ((n = kevent(w->fd, NULL, 0, kev, 8, &zero)) > 0)
+		event = true;
+	if (n == -1 && errno != EINTR)
+		die("kevent:");
+#endif
+	if (!event)
+		return false;
+
+	/* a notification is a change, even within the same second */
+	watch_stat(w);
+#ifdef USE_KQUEUE
+	watch_kevent(w);
+#endif
+	return true;
+}
+
+void
+watch_free(struct watch *w)
+{
+	if (w->fd != -1 && close(w->fd) == -1)
+		die("close:");
+#ifdef USE_KQUEUE
+	if (w->wd != -1 && close(w->wd) == -1)
+		die("close:");
+	if (w->dirfd != -1 && close(w->dirfd) == -1)
+		die("close:");
+#endif
+	free(w->path);
+	free(w->name);
+	free(w->dir);
+}
+
+static void
+bell_clear(struct bell *bell)
+{
+	for (size_t i = 0; i < bell->nre; i++)
+		regfree(&bell->re[i]);
+
+	free(bell->re);
+	bell->re = NULL;
+	bell->nre = 0;
+	bell->exists = false;
+}
+
+/*
+ * Compile every line of regex_file into its own basic regular expression,
+ * just as grep -f would do.  Lines, which are not valid expressions are
+ * skipped.
+ */
+static void
+bell_load(struct bell *bell, const char *regex_file)
+{
+	FILE *fh;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+
+	bell_clear(bell);
 
-	snprintf(cmd, sizeof cmd, "exec grep -qf %s", regex_file);
+	if ((fh = fopen(regex_file, "r")) == NULL)
+		return;
+	bell->exists = true;
 
-	if ((fh = popen(cmd, "w")) == NULL)
-		die("popen:");
+	while ((len = getline(&line, &size, fh)) != -1) {
+		regex_t *re;
 
-	if (fputs(str, fh) == EOF)
-		die("fputs:");
+		if (len > 0 && line[len - 1] == '\n')
+			line[len - 1] = '\0';
 
-	if (pclose(fh) == 0)
+		if ((re = realloc(bell->re, (bell->nre + 1) *
+		    sizeof *bell->re)) == NULL)
+			die("realloc:");
+		bell->re = re;
+
+		if (regcomp(&bell->re[bell->nre], line,
+		    REG_NOSUB|REG_NEWLINE) == 0)
+			bell->nre++;
+	}
+	if (ferror(fh))
+		die("getline:");
+
+	free(line);
+	if (fclose(fh) == EOF)
+		die("fclose:");
+}
+
+struct bell *
+bell_init(const char *regex_file, bool notify)
+{
+	struct bell *bell;
+
+	if ((bell = calloc(1, sizeof *bell)) == NULL)
+		die("calloc:");
+
+	watch_init(&bell->watch, regex_file, notify);
+	bell_load(bell, regex_file);
+
+	return bell;
+}
+
+/* recompile the expressions, if the regex file has changed */
+void
+bell_update(struct bell *bell)
+{
+	if (watch_check(&bell->watch))
+		bell_load(bell, bell->watch.path);
+}
+
+void
+bell_free(struct bell *bell)
+{
+	bell_clear(bell);
+	watch_free(&bell->watch);
+	free(bell);
+}
+
+/*
+ * Returns true if one line of str matches one of the expressions.  Without a
+ * readable regex file, everything matches.
+ */
+bool
+bell_match(struct bell *bell, const char *str)
+{
+	if (!bell->exists)
 		return true;
 
+	for (size_t i = 0; i < bell->nre; i++)
+		if (regexec(&bell->re[i], str, 0, NULL, 0) == 0)
+			return true;
+
 	return false;
 }
 
+/*
+ * Returns the next complete line of the n bytes at data, terminated by NUL
+ * instead of its newline, or NULL if data is used up.  An incomplete line at
+ * the end is kept and continued by the data of the next call.  The returned
+ * line is valid until the next call.
+ */
+char *
+linebuf_next(struct linebuf *lb, const char **data, size_t *n)
+{
+	const char *nl = memchr(*data, '\n', *n);
+	size_t len = nl == NULL ? *n : (size_t)(nl - *data);
+
+	if (*n == 0)
+		return NULL;
+
+	if (lb->len + len + 1 > lb->size) {
+		size_t size = lb->size == 0 ? BUFSIZ : lb->size;
+		char *buf;
+
+		while (lb->len + len + 1 > size)
+			size *= 2;
+		if ((buf = realloc(lb->buf, size)) == NULL)
+			die("realloc:");
+		lb->buf = buf;
+		lb->size = size;
+	}
+
+	memcpy(lb->buf + lb->len, *data, len);
+	lb->len += len;
+
+	if (nl == NULL) {
+		*data += len;
+		*n = 0;
+		return NULL;
+	}
+
+	*data += len + 1;
+	*n -= len + 1;
+	lb->buf[lb->len] = '\0';
+	lb->len = 0;
+
+	return lb->buf;
+}
+
+/* append n bytes of data to the queue */
+void
+queue_push(struct queue *q, const char *data, size_t n)
+{
+	if (q->off + q->len + n > q->size) {
+		size_t size = q->size == 0 ? BUFSIZ : q->size;
+		char *buf;
+
+		/* reuse the space of the written bytes first */
+		if (q->off > 0) {
+			memmove(q->buf, q->buf + q->off, q->len);
+			q->off = 0;
+		}
+
+		while (q->len + n > size)
+			size *= 2;
+		if (size != q->size) {
+			if ((buf = realloc(q->buf, size)) == NULL)
+				die("realloc:");
+			q->buf = buf;
+			q->size = size;
+		}
+	}
+
+	memcpy(q->buf + q->off + q->len, data, n);
+	q->len += n;
+}
+
+/*
+ * Write the pending bytes of q to fd with a single write(2) and remove the
+ * written bytes from q.  Returns the result of write(2).
+ */
+ssize_t
+queue_write(struct queue *q, int fd)
+{
+	ssize_t n;
+
+	if (q->len == 0)
+		return 0;
+	if ((n = write(fd, q->buf + q->off, q->len)) == -1)
+		return -1;
+
+	q->off += n;
+	q->len -= n;
+	if (q->len == 0)
+		q->off = 0;
+
+	return n;
+}
+
 void
-set_title(const char *term, char *title)
+set_title(const char *term, const char *title)
 {
 	if (strncmp(term, "screen", 6) == 0)
 		printf("\033k%s\033\\", title);
@@ -1,8 +1,59 @@
 #ifndef _UTIL_H_
 #define _UTIL_H_
 
+/* change detection of a single file */
+struct watch {
+	char *path;
+	char *dir;
+	char *name;	/* basename of path */
+	int fd;		/* inotify or kqueue descriptor, -1 for polling */
+	int wd;		/* inotify watch or kqueue descriptor of path */
+	int dirfd;	/* inotify watch or kqueue descriptor of dir */
+
+	/* identity of the file since the last check */
+	bool exists;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+
+	time_t polled;	/* time of the last stat(2) in polling mode */
+};
+
+/* compiled regular expressions of a .bellmatch file */
+struct bell {
+	regex_t *re;
+	size_t nre;
+	bool exists;	/* regex file was readable */
+	struct watch watch;
+};
+
+/* splits a stream of data into lines */
+struct linebuf {
+	char *buf;
+	size_t len;	/* length of the incomplete line */
+	size_t size;
+};
+
+/* bytes waiting to be written */
+struct queue {
+	char *buf;
+	size_t off;	/* first pending byte */
+	size_t len;	/* amount of pending bytes */
+	size_t size;
+};
+
 void die(const char *fmt, ...);
-bool bell_match(const char *str, const char *regex_file);
+void watch_init(struct watch *w, const char *path, bool notify);
+bool watch_check(struct watch *w);
+void watch_free(struct watch *w);
+struct bell *bell_init(const char *regex_file, bool notify);
+void bell_update(struct bell *bell);
+void bell_free(struct bell *bell);
+bool bell_match(struct bell *bell, const char *str);
+char *linebuf_next(struct linebuf *lb, const char **data, size_t *n);
+void queue_push(struct queue *q, const char *data, size_t n);
+ssize_t queue_write(struct queue *q, int fd);
 void set_title(const char *term, const char *title);
 
 #endif
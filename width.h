@@ -0,0 +1,8 @@
+#ifndef WIDTH_H
+#define WIDTH_H
+
+/* terminal columns of UTF-8 text */
+size_t width_rune(uint_least32_t cp);
+size_t width_str(const char *str, size_t len);
+
+#endif